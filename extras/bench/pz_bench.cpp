@@ -0,0 +1,498 @@
+// File: PizzaShared/extras/bench/pz_bench.cpp
+//
+// Host-side micro benchmarks for the protocol hot path. Not part of the
+// Arduino build (the IDE ignores extras/). Build and run on Linux/macOS:
+//
+//   SRC=../../src
+//   LIB="$SRC/PizzaProtocol.cpp $SRC/PizzaSimRadio.cpp $SRC/PizzaNow.cpp"
+//   g++ -O2 -std=c++17 -I$SRC pz_bench.cpp $LIB -o pz_bench
+//   ./pz_bench                         # human-readable table
+//   ./pz_bench --json > base.json      # one JSON object per result line
+//   ./pz_bench --baseline base.json    # exit 2 if any result is >15% slower
+//   ./pz_bench --baseline base.json --tolerance 25
+//
+// pack/unpack use the PZ_CRC_ENGINE from BuildConfig.h; add e.g.
+// -DPZ_CRC_ENGINE=PZ_CRC_SLICE8 to the g++ line to measure another engine.
+#include "PizzaProtocol.h"
+#include "PizzaWire.h"
+#include "PizzaSimRadio.h"
+#include "PizzaNow.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+typedef uint16_t (*CrcFn)(const uint8_t*, size_t);
+
+struct CrcEngine {
+  const char* name;
+  CrcFn       fn;
+};
+
+const CrcEngine kEngines[] = {
+  { "bitwise", PizzaProtocol::crc16Bitwise },
+  { "table",   PizzaProtocol::crc16Table   },
+  { "slice4",  PizzaProtocol::crc16Slice4  },
+  { "slice8",  PizzaProtocol::crc16Slice8  },
+  { "rom",     PizzaProtocol::crc16Rom     },   // == table on host
+};
+
+volatile uint16_t g_sink;   // keeps the optimizer from dropping the work
+
+double nowSec() {
+  using namespace std::chrono;
+  return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// ===== Results =====
+struct Result {
+  std::string name;
+  double nsPerOp;
+  double opsPerSec;
+  double mbPerSec;           // 0 when not byte-oriented
+};
+
+std::vector<Result> g_results;
+bool g_json = false;
+
+void report(const std::string& name, size_t ops, size_t bytes, double dt) {
+  Result r;
+  r.name      = name;
+  r.nsPerOp   = dt * 1e9 / (double)ops;
+  r.opsPerSec = (double)ops / dt;
+  r.mbPerSec  = bytes ? (double)bytes / dt / 1e6 : 0.0;
+  g_results.push_back(r);
+  if (g_json) {
+    printf("{\"name\":\"%s\",\"ns_per_op\":%.2f,\"ops_per_sec\":%.0f,\"mb_per_sec\":%.1f}\n",
+           r.name.c_str(), r.nsPerOp, r.opsPerSec, r.mbPerSec);
+  } else {
+    printf("%-34s %9.1f ns/op %12.0f ops/s", r.name.c_str(), r.nsPerOp, r.opsPerSec);
+    if (bytes) printf(" %8.1f MB/s", r.mbPerSec);
+    printf("\n");
+  }
+}
+
+void note(const char* msg) {
+  if (!g_json) printf("%s\n", msg);
+}
+
+// All engines must agree with the bitwise reference on every length 0..256.
+bool crcSelfTest(const std::vector<uint8_t>& buf) {
+  bool ok = true;
+  for (size_t n = 0; n <= 256 && n <= buf.size(); n++) {
+    uint16_t ref = PizzaProtocol::crc16Bitwise(buf.data(), n);
+    for (const CrcEngine& e : kEngines) {
+      if (e.fn(buf.data(), n) != ref) {
+        printf("MISMATCH engine=%s len=%zu\n", e.name, n);
+        ok = false;
+      }
+    }
+  }
+  // CRC-16/CCITT-FALSE check value
+  const uint8_t check[] = { '1','2','3','4','5','6','7','8','9' };
+  if (PizzaProtocol::crc16(check, sizeof(check)) != 0x29B1) {
+    printf("MISMATCH crc16(\"123456789\") != 0x29B1\n");
+    ok = false;
+  }
+  return ok;
+}
+
+void benchCrc(const std::vector<uint8_t>& buf, size_t frameLen) {
+  const size_t iters = (64u << 20) / frameLen;   // ~64 MB per engine
+  for (const CrcEngine& e : kEngines) {
+    double t0 = nowSec();
+    uint16_t acc = 0;
+    for (size_t i = 0; i < iters; i++) acc ^= e.fn(buf.data() + (i & 15), frameLen);
+    double dt = nowSec() - t0;
+    g_sink = acc;
+    report(std::string("crc16.") + e.name + ".len" + std::to_string(frameLen),
+           iters, iters * frameLen, dt);
+  }
+}
+
+// ===== Protocol hot path: realistic message mix =====
+// Frames as they appear on the air: wire prefix + header + payload.
+struct MixMsg {
+  const char* name;
+  uint8_t     type;
+  Role        role;
+  uint8_t     house;
+  std::vector<uint8_t> payload;
+  unsigned    weight;        // relative frequency in the mix
+};
+
+template <typename T>
+std::vector<uint8_t> bytesOf(const T& v) {
+  const uint8_t* p = (const uint8_t*)&v;
+  return std::vector<uint8_t>(p, p + sizeof(T));
+}
+
+std::vector<MixMsg> buildMix() {
+  std::vector<MixMsg> mix;
+
+  HelloPayload hello{};
+  strncpy(hello.fw, "0.1.0", sizeof(hello.fw));
+  hello.proto = PROTOCOL_VERSION;
+  mix.push_back({ "hello", HELLO, HOUSE_NODE, 3, bytesOf(hello), 1 });
+
+  PzOrderItemSetPayload item{};
+  item.index = 2; item.house_id = 4; item.mask = 0x15;
+  strncpy(item.text, "Pepperoni + pineapple for the house with the red door", sizeof(item.text) - 1);
+  item.order_id = 1234; item.remain_s = 90;
+  mix.push_back({ "order_item_set", ORDER_ITEM_SET, CENTRAL, 0, bytesOf(item), 6 });
+
+  HouseDigitalSetPayload hd{};
+  hd.house_id = 5; hd.flags = 7; hd.win_fx = WIN_FX_CHASE_CW; hd.win_v = 200;
+  strncpy(hd.panel_text, "ORDER UP", sizeof(hd.panel_text) - 1);
+  hd.spk_clip = 3; hd.spk_vol = 10;
+  mix.push_back({ "house_digital_set", HOUSE_DIGITAL_SET, CENTRAL, 5, bytesOf(hd), 8 });
+
+  DeliverScanPayload scan{};
+  scan.house_id = 2; scan.uid_len = 7;
+  for (uint8_t i = 0; i < 7; i++) scan.uid[i] = (uint8_t)(0x40 + i);
+  mix.push_back({ "deliver_scan", DELIVER_SCAN, HOUSE_NODE, 2, bytesOf(scan), 4 });
+  return mix;
+}
+
+void benchHotPath() {
+  const std::vector<MixMsg> mix = buildMix();
+
+  // Weighted schedule so the mixed run matches the relative frequencies.
+  std::vector<size_t> order;
+  for (size_t i = 0; i < mix.size(); i++) {
+    for (unsigned w = 0; w < mix[i].weight; w++) order.push_back(i);
+  }
+
+  // Pre-built wire frames for the decode side.
+  std::vector<std::vector<uint8_t>> wire(mix.size());
+  for (size_t i = 0; i < mix.size(); i++) {
+    uint8_t f[PizzaWire::MAX_FRAME];
+    uint8_t pre = PizzaWire::writePrefix(f);
+    size_t n = PizzaProtocol::pack(mix[i].type, mix[i].role, mix[i].house, 1,
+                                   mix[i].payload.data(), (uint16_t)mix[i].payload.size(),
+                                   f + pre, sizeof(f) - pre);
+    wire[i].assign(f, f + pre + n);
+  }
+
+  const size_t iters = 2000000;
+  uint8_t out[PizzaWire::MAX_FRAME];
+
+  for (size_t i = 0; i < mix.size(); i++) {
+    const MixMsg& m = mix[i];
+    const uint16_t plen = (uint16_t)m.payload.size();
+    size_t bytes = 0;
+
+    double t0 = nowSec();
+    for (size_t k = 0; k < iters; k++) {
+      uint8_t pre = PizzaWire::writePrefix(out);
+      bytes += pre + PizzaProtocol::pack(m.type, m.role, m.house, (uint16_t)k,
+                                         m.payload.data(), plen, out + pre, sizeof(out) - pre);
+    }
+    report(std::string("encode.") + m.name, iters, bytes, nowSec() - t0);
+    g_sink = out[7];
+
+    const std::vector<uint8_t>& w = wire[i];
+    unsigned okCount = 0;
+    t0 = nowSec();
+    for (size_t k = 0; k < iters; k++) {
+      const uint8_t* inner; int innerLen;
+      MsgHeader h; const uint8_t* p; uint16_t pl;
+      if (PizzaWire::strip(w.data(), (int)w.size(), inner, innerLen) &&
+          PizzaProtocol::unpack(inner, (uint16_t)innerLen, h, p, pl)) okCount++;
+    }
+    report(std::string("decode.") + m.name, iters, iters * w.size(), nowSec() - t0);
+    if (okCount != iters) printf("DECODE FAILED for %s\n", m.name);
+  }
+
+  // Mixed round trip: encode then strip + unpack, in mix order.
+  size_t bytes = 0;
+  double t0 = nowSec();
+  for (size_t k = 0; k < iters; k++) {
+    const MixMsg& m = mix[order[k % order.size()]];
+    uint8_t pre = PizzaWire::writePrefix(out);
+    size_t n = PizzaProtocol::pack(m.type, m.role, m.house, (uint16_t)k, m.payload.data(),
+                                   (uint16_t)m.payload.size(), out + pre, sizeof(out) - pre);
+    const uint8_t* inner; int innerLen;
+    MsgHeader h; const uint8_t* p; uint16_t pl;
+    if (PizzaWire::strip(out, (int)(pre + n), inner, innerLen) &&
+        PizzaProtocol::unpack(inner, (uint16_t)innerLen, h, p, pl)) bytes += pre + n;
+  }
+  report("roundtrip.mix", iters, bytes, nowSec() - t0);
+}
+
+// ===== Baseline comparison =====
+// Reads lines produced by --json and flags results that got slower.
+int compareBaseline(const char* path, double tolerancePct) {
+  FILE* f = fopen(path, "r");
+  if (!f) { fprintf(stderr, "cannot open baseline %s\n", path); return 1; }
+  std::map<std::string, double> base;
+  char line[512];
+  while (fgets(line, sizeof(line), f)) {
+    char name[128]; double ns;
+    if (sscanf(line, "{\"name\":\"%127[^\"]\",\"ns_per_op\":%lf", name, &ns) == 2) base[name] = ns;
+  }
+  fclose(f);
+
+  int worse = 0;
+  for (const Result& r : g_results) {
+    auto it = base.find(r.name);
+    if (it == base.end() || it->second <= 0) continue;
+    double deltaPct = (r.nsPerOp - it->second) * 100.0 / it->second;
+    if (deltaPct > tolerancePct) {
+      fprintf(stderr, "REGRESSION %-34s %9.1f -> %9.1f ns/op (+%.1f%%)\n",
+              r.name.c_str(), it->second, r.nsPerOp, deltaPct);
+      worse++;
+    }
+  }
+  if (!g_json) printf("baseline %s: %d regression(s) beyond %.0f%%\n", path, worse, tolerancePct);
+  return worse ? 2 : 0;
+}
+
+// ===== Simulated fleet round trip =====
+// Central unicasts HOUSE_DIGITAL_SET to six HouseNodes over the simulated
+// air; each house answers ACK_GENERIC. Panels, OrderStation and PizzaNow
+// sit on the same channel and just receive broadcasts. Every node here is
+// scripted on PizzaProtocol/PizzaWire, so this measures the air model and
+// framing alone; benchStack() below runs the real PizzaNow as Central. Time
+// is virtual, so RTT reflects the configured latency/loss; host msgs/s shows
+// sim overhead.
+struct SimNode {
+  uint8_t  mac[6];
+  Role     role;
+  uint8_t  house;
+  int      id;
+  PizzaSimRadio::Medium* air;
+  uint64_t* now;
+  uint32_t rx;
+};
+
+struct SimCentral {
+  uint64_t sentAt[7];
+  uint16_t seq[7];
+  uint32_t acked;
+  double   rttSumUs;
+  uint64_t rttMaxUs;
+};
+
+SimCentral g_central;
+
+size_t buildFrame(uint8_t* out, uint8_t type, Role role, uint8_t house, uint16_t seq,
+                  const void* payload, uint16_t len) {
+  uint8_t pre = PizzaWire::writePrefix(out);
+  return pre + PizzaProtocol::pack(type, role, house, seq, payload, len, out + pre,
+                                   PizzaWire::MAX_FRAME - pre);
+}
+
+void houseRx(void* ctx, const uint8_t src[6], const uint8_t* data, int len) {
+  SimNode& n = *(SimNode*)ctx;
+  const uint8_t* inner; int innerLen;
+  if (!PizzaWire::strip(data, len, inner, innerLen)) return;
+  MsgHeader h; const uint8_t* p; uint16_t pl;
+  if (!PizzaProtocol::unpack(inner, (uint16_t)innerLen, h, p, pl)) return;
+  n.rx++;
+  if (h.type != HOUSE_DIGITAL_SET || n.role != HOUSE_NODE) return;
+  AckGenericPayload ack{ h.type, 0, h.seq };
+  uint8_t f[PizzaWire::MAX_FRAME];
+  size_t fl = buildFrame(f, ACK_GENERIC, n.role, n.house, h.seq, &ack, sizeof(ack));
+  n.air->send(n.id, src, f, fl, *n.now);
+}
+
+void centralRx(void* ctx, const uint8_t src[6], const uint8_t* data, int len) {
+  SimNode& n = *(SimNode*)ctx;
+  const uint8_t* inner; int innerLen;
+  if (!PizzaWire::strip(data, len, inner, innerLen)) return;
+  MsgHeader h; const uint8_t* p; uint16_t pl;
+  if (!PizzaProtocol::unpack(inner, (uint16_t)innerLen, h, p, pl)) return;
+  if (h.type != ACK_GENERIC || h.house_id < 1 || h.house_id > 6) return;
+  AckGenericPayload ack; memcpy(&ack, p, sizeof(ack));
+  if (ack.acked_seq != g_central.seq[h.house_id]) return;   // stale or duplicate
+  uint64_t rtt = *n.now - g_central.sentAt[h.house_id];
+  g_central.acked++;
+  g_central.rttSumUs += (double)rtt;
+  if (rtt > g_central.rttMaxUs) g_central.rttMaxUs = rtt;
+  g_central.seq[h.house_id] = 0;
+  (void)src;
+}
+
+void benchSim(uint8_t lossPct, uint8_t dupPct) {
+  PizzaSimRadio::Config cfg;
+  cfg.lossPct = lossPct; cfg.dupPct = dupPct;
+  cfg.latencyUs = 1500; cfg.jitterUs = 1000; cfg.seed = 42;
+  PizzaSimRadio::Medium air(cfg);
+  uint64_t now = 0;
+  g_central = SimCentral();
+
+  std::vector<SimNode> nodes;
+  auto add = [&](Role role, uint8_t house) {
+    SimNode n{};
+    n.mac[0] = 0x02; n.mac[4] = (uint8_t)role; n.mac[5] = house;
+    n.role = role; n.house = house; n.air = &air; n.now = &now;
+    nodes.push_back(n);
+  };
+  add(CENTRAL, 0);
+  for (uint8_t h = 1; h <= 6; h++) add(HOUSE_NODE, h);
+  add(HOUSE_PANEL, 1); add(ORDERS_PANEL, 0); add(ORDERS_NODE, 0); add(PIZZA_NODE, 0);
+  for (SimNode& n : nodes) {
+    n.id = air.attach(n.mac, n.role == CENTRAL ? centralRx : houseRx, &n, 11);
+  }
+
+  const uint32_t rounds = 20000;
+  uint16_t seq = 1;
+  uint32_t sent = 0;
+  double t0 = nowSec();
+  for (uint32_t r = 0; r < rounds; r++) {
+    for (uint8_t h = 1; h <= 6; h++) {
+      HouseDigitalSetPayload hd{};
+      hd.house_id = h; hd.flags = 1; hd.win_fx = WIN_FX_PULSE;
+      uint8_t f[PizzaWire::MAX_FRAME];
+      size_t fl = buildFrame(f, HOUSE_DIGITAL_SET, CENTRAL, 0, seq, &hd, sizeof(hd));
+      g_central.seq[h] = seq++;
+      g_central.sentAt[h] = now;
+      air.send(nodes[0].id, nodes[h].mac, f, fl, now);
+      sent++;
+      now += 200;                         // Central paces sends 200 us apart
+    }
+    uint64_t until = now + 20000;         // 20 ms budget for the round's ACKs
+    while (air.nextDueUs() <= until) { now = air.nextDueUs(); air.poll(now); }
+    now = until;
+  }
+  double dt = nowSec() - t0;
+  const PizzaSimRadio::Stats& st = air.stats();
+  if (g_json) return;                     // virtual-time figures; not a regression signal
+  printf("sim loss=%2u%% dup=%2u%%  acked %5.1f%%  rtt avg %6.0f us max %6llu us  "
+         "host %8.0f msgs/s (lost=%u dup=%u)\n",
+         (unsigned)lossPct, (unsigned)dupPct, 100.0 * g_central.acked / sent,
+         g_central.acked ? g_central.rttSumUs / g_central.acked : 0.0,
+         (unsigned long long)g_central.rttMaxUs, st.delivered / dt,
+         (unsigned)st.lost, (unsigned)st.duplicated);
+}
+
+// ===== Real stack over the simulated air =====
+// The same fleet, but Central is PizzaNow itself (built against PizzaHost.h,
+// joined through a PizzaSimRadio::Link) sending HOUSE_DIGITAL_SET with
+// sendReliable(): ACK matching, retransmit backoff, send-status handling and
+// the reply path all run as on a device. The virtual clock advances to the
+// next frame on the air or the next 1 ms tick, whichever comes first.
+struct StackRun {
+  uint64_t sentAt[7];
+  uint32_t ok, failed;
+  double   latSumUs;
+  uint64_t latMaxUs;
+  uint8_t  open;             // reliable sends of this round not yet completed
+};
+
+StackRun g_stack;
+
+void benchStack(uint8_t lossPct, uint8_t dupPct) {
+  PizzaSimRadio::Config cfg;
+  cfg.lossPct = lossPct; cfg.dupPct = dupPct;
+  cfg.latencyUs = 1500; cfg.jitterUs = 1000; cfg.seed = 42;
+  PizzaSimRadio::Medium air(cfg);
+  PizzaHost::setNowUs(0);
+  uint64_t now = 0;
+  g_stack = StackRun();
+
+  std::vector<SimNode> nodes;
+  nodes.reserve(7);
+  for (uint8_t h = 1; h <= 6; h++) {
+    SimNode n{};
+    n.mac[0] = 0x02; n.mac[4] = (uint8_t)HOUSE_NODE; n.mac[5] = h;
+    n.role = HOUSE_NODE; n.house = h; n.air = &air; n.now = &now;
+    nodes.push_back(n);
+  }
+  for (SimNode& n : nodes) n.id = air.attach(n.mac, houseRx, &n, 11);
+
+  const uint8_t centralMac[6] = { 0x02, 0, 0, 0, (uint8_t)CENTRAL, 0 };
+  PizzaSimRadio::Link link(air, centralMac, PizzaHost::nowUs);
+  PizzaNow::setTransport(&link);
+  PizzaNow::setIdentity(CENTRAL, 0);
+  if (!PizzaNow::begin(11)) { printf("stack: PizzaNow::begin failed\n"); return; }
+
+  const uint32_t rounds = 2000;
+  uint32_t sent = 0;
+  double t0 = nowSec();
+  for (uint32_t r = 0; r < rounds; r++) {
+    for (uint8_t h = 1; h <= 6; h++) {
+      HouseDigitalSetPayload hd{};
+      hd.house_id = h; hd.flags = 1; hd.win_fx = WIN_FX_PULSE;
+      g_stack.sentAt[h] = now;
+      uint16_t seq = PizzaNow::sendReliable(nodes[h - 1].mac, HOUSE_DIGITAL_SET, &hd, sizeof(hd),
+        [h](uint16_t, bool ok, const uint8_t*) {
+          const uint64_t lat = PizzaHost::nowUs() - g_stack.sentAt[h];
+          if (ok) {
+            g_stack.ok++;
+            g_stack.latSumUs += (double)lat;
+            if (lat > g_stack.latMaxUs) g_stack.latMaxUs = lat;
+          } else {
+            g_stack.failed++;
+          }
+          g_stack.open--;
+        });
+      if (seq) { g_stack.open++; sent++; }
+      now += 200;                         // Central paces sends 200 us apart
+      PizzaHost::setNowUs((int64_t)now);
+    }
+    while (g_stack.open) {                // every send ends in ACK or give-up
+      const uint64_t tick = now + 1000;
+      const uint64_t due  = air.nextDueUs();
+      now = due < tick ? due : tick;
+      PizzaHost::setNowUs((int64_t)now);
+      PizzaNow::loop();
+    }
+  }
+  double dt = nowSec() - t0;
+  PizzaNow::Stats st;
+  PizzaNow::stats(st);
+  PizzaNow::deinit();
+  PizzaNow::setTransport(nullptr);
+  if (g_json) return;                     // virtual-time figures; not a regression signal
+  printf("stack loss=%2u%% dup=%2u%%  delivered %5.1f%%  latency avg %6.0f us max %7llu us  "
+         "host %8.0f msgs/s (send-status fail=%u)\n",
+         (unsigned)lossPct, (unsigned)dupPct, sent ? 100.0 * g_stack.ok / sent : 0.0,
+         g_stack.ok ? g_stack.latSumUs / g_stack.ok : 0.0,
+         (unsigned long long)g_stack.latMaxUs, air.stats().delivered / dt,
+         (unsigned)st.sendStatusFail);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const char* baseline = nullptr;
+  double tolerancePct = 15.0;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--json")) g_json = true;
+    else if (!strcmp(argv[i], "--baseline") && i + 1 < argc) baseline = argv[++i];
+    else if (!strcmp(argv[i], "--tolerance") && i + 1 < argc) tolerancePct = atof(argv[++i]);
+    else { fprintf(stderr, "usage: %s [--json] [--baseline FILE] [--tolerance PCT]\n", argv[0]); return 1; }
+  }
+
+  std::vector<uint8_t> buf(256 + 16);
+  srand(1);
+  for (uint8_t& b : buf) b = (uint8_t)rand();
+
+  if (!crcSelfTest(buf)) return 1;
+  note(PizzaProtocol::crc16HasRom() ? "crc16 engines agree (rom path native)"
+                                    : "crc16 engines agree (rom path falls back to table)");
+
+  benchCrc(buf, 16);    // GAME_STATE-sized frame
+  benchCrc(buf, 137);   // ORDER_ITEM_SET-sized frame
+  benchCrc(buf, 250);   // full ESP-NOW frame
+
+  benchHotPath();
+
+  benchSim(0, 0);
+  benchSim(10, 5);
+  benchSim(30, 10);
+
+  benchStack(0, 0);
+  benchStack(10, 5);
+  benchStack(30, 10);
+
+  return baseline ? compareBaseline(baseline, tolerancePct) : 0;
+}
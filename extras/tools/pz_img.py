@@ -0,0 +1,225 @@
+#!/usr/bin/env python3
+# File: PizzaShared/extras/tools/pz_img.py
+#
+# Builds encoded OTA images for PizzaOta (format: src/PizzaOtaImage.h) and the
+# optional sidecar manifest (src/PizzaOtaManifest.h). Python 3 stdlib only.
+#
+#   pz_img.py pack  new.bin            -o new.pzi      # deflate only
+#   pz_img.py delta old.bin new.bin    -o new.pzi      # diff vs. the image the devices run
+#   pz_img.py manifest new.pzi --version 1.4.2         # writes new.pzi.manifest
+#
+# pack/delta take --verify (rebuild the output and compare it with new.bin
+# byte for byte) and --manifest VERSION (also write <out>.manifest).
+# Serve the result under the same OTA_REL_* path as the .bin it replaces;
+# devices detect the encoding from the first bytes.
+import argparse
+import hashlib
+import struct
+import sys
+import zlib
+
+MAGIC = b'PZI1'
+KIND_DEFLATE, KIND_DELTA = 1, 2
+OP_END, OP_COPY, OP_ADD, OP_LIT = 0, 1, 2, 3
+HDR = struct.Struct('<4sB3xII32s')            # PzImgHeader, 48 bytes
+
+KEY = 32          # bytes hashed per base index entry
+MIN_MATCH = 24    # shorter exact matches stay literal
+PROBE = 16        # look-ahead when deciding whether a mismatch ends an ADD run
+
+
+def deflate(data):
+    c = zlib.compressobj(9, zlib.DEFLATED, -15, 9)
+    return c.compress(data) + c.flush()
+
+
+def inflate(data):
+    d = zlib.decompressobj(-15)
+    return d.decompress(data) + d.flush()
+
+
+# ===== Diff =====
+def index_base(base):
+    idx = {}
+    for i in range(0, len(base) - KEY + 1, 4):     # ESP32 code and data are word aligned
+        idx.setdefault(base[i:i + KEY], i)
+    return idx
+
+
+def extend(base, new, s, i):
+    """Length of the ADD-able run at new[i] / base[s]: exact bytes plus short
+    mismatching stretches as long as most of the next PROBE bytes still agree."""
+    n = 0
+    lim = min(len(base) - s, len(new) - i)
+    while n < lim:
+        step = min(64, lim - n)
+        if base[s + n:s + n + step] == new[i + n:i + n + step]:
+            n += step
+            continue
+        if base[s + n] == new[i + n]:
+            n += 1
+            continue
+        w = min(PROBE, lim - n)
+        same = sum(1 for k in range(w) if base[s + n + k] == new[i + n + k])
+        if same * 2 < w:
+            break
+        n += 1
+    # Trim a mismatching tail so the run ends on agreeing bytes.
+    while n and base[s + n - 1] != new[i + n - 1]:
+        n -= 1
+    return n
+
+
+def diff_ops(base, new):
+    idx = index_base(base)
+    ops = []
+    lit_start = 0
+    i = 0
+    nxt = None                     # base offset continuing the previous run
+    while i + KEY <= len(new):
+        s = None
+        if nxt is not None and nxt + KEY <= len(base) and base[nxt:nxt + 8] == new[i:i + 8]:
+            s = nxt
+        else:
+            s = idx.get(new[i:i + KEY])
+        if s is None:
+            i += 1
+            continue
+        n = extend(base, new, s, i)
+        if n < MIN_MATCH:
+            i += 1
+            continue
+        if lit_start < i:
+            ops.append((OP_LIT, new[lit_start:i]))
+        seg_new, seg_base = new[i:i + n], base[s:s + n]
+        if seg_new == seg_base:
+            ops.append((OP_COPY, s, n))
+        else:
+            ops.append((OP_ADD, s, bytes((a - b) & 0xFF for a, b in zip(seg_new, seg_base))))
+        i += n
+        lit_start = i
+        nxt = s + n
+    if lit_start < len(new):
+        ops.append((OP_LIT, new[lit_start:]))
+    return ops
+
+
+def encode_ops(ops):
+    out = bytearray()
+    for op in ops:
+        if op[0] == OP_COPY:
+            out += struct.pack('<BII', OP_COPY, op[1], op[2])
+        elif op[0] == OP_ADD:
+            out += struct.pack('<BII', OP_ADD, op[1], len(op[2])) + op[2]
+        else:
+            out += struct.pack('<BI', OP_LIT, len(op[1])) + op[1]
+    out.append(OP_END)
+    return bytes(out)
+
+
+# ===== Reference decoder (mirrors OtaImage::Decoder) =====
+def decode(img, base=None):
+    magic, kind, out_size, base_size, base_sha = HDR.unpack_from(img)
+    if magic != MAGIC:
+        raise ValueError('not a PZI1 image')
+    body = inflate(img[HDR.size:])
+    if kind == KIND_DEFLATE:
+        out = body
+    elif kind == KIND_DELTA:
+        if base is None or len(base) < base_size or hashlib.sha256(base[:base_size]).digest() != base_sha:
+            raise ValueError('base image does not match')
+        out = bytearray()
+        p = 0
+        while True:
+            op = body[p]; p += 1
+            if op == OP_END:
+                break
+            if op == OP_LIT:
+                (n,) = struct.unpack_from('<I', body, p); p += 4
+                out += body[p:p + n]; p += n
+                continue
+            s, n = struct.unpack_from('<II', body, p); p += 8
+            if s + n > base_size:
+                raise ValueError('op reads past the base')
+            if op == OP_COPY:
+                out += base[s:s + n]
+            elif op == OP_ADD:
+                out += bytes((a + b) & 0xFF for a, b in zip(base[s:s + n], body[p:p + n])); p += n
+            else:
+                raise ValueError('bad op %d' % op)
+        out = bytes(out)
+    else:
+        raise ValueError('bad kind %d' % kind)
+    if len(out) != out_size:
+        raise ValueError('size %d != header %d' % (len(out), out_size))
+    return out
+
+
+# ===== Manifest =====
+def manifest(data, version, block):
+    lines = ['pzota 1', 'version %s' % version, 'size %d' % len(data), 'block %d' % block]
+    for off in range(0, len(data), block):
+        lines.append('b ' + hashlib.sha256(data[off:off + block]).hexdigest())
+    return '\n'.join(lines) + '\n'
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__)
+    ap.add_argument('cmd', choices=['pack', 'delta', 'manifest'])
+    ap.add_argument('files', nargs='+')
+    ap.add_argument('-o', '--out')
+    ap.add_argument('--verify', action='store_true')
+    ap.add_argument('--manifest', metavar='VERSION', dest='man_version')
+    ap.add_argument('--version', help='manifest command: image version')
+    ap.add_argument('--block', type=int, default=65536, help='manifest block size (multiple of 4096)')
+    a = ap.parse_args()
+    if a.block % 4096:
+        ap.error('--block must be a multiple of 4096')
+
+    def rd(path):
+        with open(path, 'rb') as f:
+            return f.read()
+
+    if a.cmd == 'manifest':
+        if len(a.files) != 1 or not a.version:
+            ap.error('manifest takes one file and --version')
+        with open(a.files[0] + '.manifest', 'w') as f:
+            f.write(manifest(rd(a.files[0]), a.version, a.block))
+        return 0
+
+    base = None
+    if a.cmd == 'pack':
+        if len(a.files) != 1:
+            ap.error('pack takes one file')
+        new = rd(a.files[0])
+        img = HDR.pack(MAGIC, KIND_DEFLATE, len(new), 0, b'\0' * 32) + deflate(new)
+    else:
+        if len(a.files) != 2:
+            ap.error('delta takes old.bin new.bin')
+        base, new = rd(a.files[0]), rd(a.files[1])
+        ops = diff_ops(base, new)
+        img = HDR.pack(MAGIC, KIND_DELTA, len(new), len(base), hashlib.sha256(base).digest()) + \
+            deflate(encode_ops(ops))
+        kinds = {OP_COPY: 0, OP_ADD: 0, OP_LIT: 0}
+        for op in ops:
+            kinds[op[0]] += 1
+        print('ops: %d copy, %d add, %d literal' % (kinds[OP_COPY], kinds[OP_ADD], kinds[OP_LIT]))
+
+    out = a.out or a.files[-1] + '.pzi'
+    with open(out, 'wb') as f:
+        f.write(img)
+    print('%s: %d -> %d bytes (%.1f%%)' % (out, len(new), len(img), 100.0 * len(img) / max(1, len(new))))
+
+    if a.verify:
+        if decode(img, base) != new:
+            print('VERIFY FAILED: rebuilt image differs', file=sys.stderr)
+            return 1
+        print('verify: rebuilt image is bit-exact')
+    if a.man_version:
+        with open(out + '.manifest', 'w') as f:
+            f.write(manifest(img, a.man_version, a.block))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
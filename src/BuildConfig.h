@@ -1,7 +1,7 @@
 #pragma once
 
 // --- Versions ---
-#define PROTOCOL_VERSION   2
+#define PROTOCOL_VERSION   3   // 3 = understands compact (length-prefixed) text messages
 #define FW_VERSION         "0.1.0"
 
 // --- Radio (runtime) ---
@@ -10,7 +10,7 @@
 //
 // This repo is currently hard-coded per-game (per your preference). If you
 // change this value, reflash all Pizza devices.
-#define ESPNOW_CHANNEL     11   // fixed; Wi-Fi STA only during OTA window
+#define ESPNOW_CHANNEL     11   // boot default; see PizzaNow::enableChannelDiscovery
 
 // --- Wire framing ---
 // To prevent cross-game ESP-NOW interference, Pizza frames every payload with
@@ -37,6 +37,189 @@
   #define PZ_WIRE_RX_LEGACY 0
 #endif
 
+// --- RX queue (PizzaNow::enableRxQueue) ---
+// ~260 B per slot, allocated only when the queue is enabled.
+#ifndef PZ_RX_QUEUE_SLOTS
+  #define PZ_RX_QUEUE_SLOTS  16   // must be a power of two
+#endif
+// Stack of the optional pz_rx task, in bytes (the ESP32 FreeRTOS port counts
+// bytes, not words). Handlers run on it: dispatch keeps ~1 KB of frame and
+// expand buffers live, an ACK/reply adds a 250 B frame, and one log line
+// costs ~1.5 KB. Raise it if your handlers do more than that.
+#ifndef PZ_RX_TASK_STACK_BYTES
+  #define PZ_RX_TASK_STACK_BYTES  6144
+#endif
+
+// --- Duplicate suppression (PizzaNow::enableDedupe) ---
+// One 64-seq window per (sender MAC, role) in a small open-addressed table.
+#ifndef PZ_DEDUP_PEERS
+  #define PZ_DEDUP_PEERS     16      // must be a power of two
+#endif
+#ifndef PZ_DEDUP_TTL_MS
+  #define PZ_DEDUP_TTL_MS    10000   // idle sender is forgotten (covers reboots)
+#endif
+
+// --- TX coalescing (PizzaNow::queueMsg) ---
+#ifndef PZ_BATCH_PEERS
+  #define PZ_BATCH_PEERS     4       // destinations batched at once (incl. broadcast)
+#endif
+#ifndef PZ_BATCH_FLUSH_MS
+  #define PZ_BATCH_FLUSH_MS  5       // max time a queued message waits for company
+#endif
+
+// --- Fragmentation (PizzaNow::sendMsg with len > PZ_PAYLOAD_MAX) ---
+#ifndef PZ_FRAG_MAX_BYTES
+  #define PZ_FRAG_MAX_BYTES  1536    // largest reassembled payload (<= 32 slices)
+#endif
+#ifndef PZ_FRAG_SLOTS
+  #define PZ_FRAG_SLOTS      2       // messages reassembled concurrently
+#endif
+#ifndef PZ_FRAG_TIMEOUT_MS
+  #define PZ_FRAG_TIMEOUT_MS 500     // partial message is discarded after this
+#endif
+#ifndef PZ_FRAG_TX_SLOTS
+  #define PZ_FRAG_TX_SLOTS   2       // fragmented messages queued for sending
+#endif
+#ifndef PZ_FRAG_DONE_MEMO
+  #define PZ_FRAG_DONE_MEMO  8       // completed (sender, msg_id) pairs remembered
+#endif
+
+// --- Compact text messages (protocol v3) ---
+// 1: PizzaNow expands received compact messages back into the fixed structs,
+//    so existing RxHandlers keep working unchanged.
+// 0: handlers see the compact types and decode them with the zero-copy
+//    PizzaProtocol::decode(...) views.
+#ifndef PZ_COMPACT_EXPAND
+  #define PZ_COMPACT_EXPAND  1
+#endif
+#ifndef PZ_PEER_MAX
+  #define PZ_PEER_MAX        24      // peers whose HELLO proto version we remember
+#endif
+
+// --- Order table sync (PizzaOrders) ---
+#ifndef PZ_ORDERS_HEARTBEAT_MS
+  #define PZ_ORDERS_HEARTBEAT_MS  2000   // owner re-announces its generation when idle
+#endif
+#ifndef PZ_ORDERS_SNAP_RETRY_MS
+  #define PZ_ORDERS_SNAP_RETRY_MS 1000   // min gap between a station's snapshot requests
+#endif
+
+// --- Stats (PizzaNow::stats) ---
+#ifndef PZ_STATS
+  #define PZ_STATS           1       // 0 compiles all counters and timing out
+#endif
+#ifndef PZ_STATS_TYPES
+  #define PZ_STATS_TYPES     24      // MsgTypes tracked individually (rest share "other")
+#endif
+#ifndef PZ_STATS_BUCKETS
+  #define PZ_STATS_BUCKETS   12      // handler-time histogram: <1us, <2us, <4us ... >=1ms
+#endif
+
+// --- Time sync (PizzaNow::enableTimeSync) ---
+#ifndef PZ_TSYNC_BEACON_MS
+  #define PZ_TSYNC_BEACON_MS 1000    // Central TIME_BEACON period
+#endif
+#ifndef PZ_TSYNC_REQ_MS
+  #define PZ_TSYNC_REQ_MS    2000    // node TIME_REQ period (RTT samples)
+#endif
+#ifndef PZ_TSYNC_WINDOW
+  #define PZ_TSYNC_WINDOW    8       // samples; the lowest-RTT one sets the offset
+#endif
+
+// --- Deferred TIMED delivery (PizzaNow, PizzaUtils::Scheduler) ---
+#ifndef PZ_SCHED_SLOTS
+  #define PZ_SCHED_SLOTS     8       // TIMED messages held at once (~220 B each)
+#endif
+
+// --- Channel discovery (PizzaNow::enableChannelDiscovery) ---
+#ifndef PZ_CHAN_ANNOUNCE_MS
+  #define PZ_CHAN_ANNOUNCE_MS 1000   // Central CHAN_ANNOUNCE period
+#endif
+#ifndef PZ_CHAN_DWELL_MS
+  #define PZ_CHAN_DWELL_MS    40     // node listens this long per channel while searching
+#endif
+#ifndef PZ_CHAN_LOST_MS
+  #define PZ_CHAN_LOST_MS     3500   // node re-searches after this long without Central
+#endif
+
+// --- Fleet OTA (PizzaFleetOta, Central) ---
+#ifndef PZ_FLEET_MAX
+  #define PZ_FLEET_MAX          PZ_PEER_MAX  // devices tracked
+#endif
+#ifndef PZ_FLEET_CONCURRENCY
+  #define PZ_FLEET_CONCURRENCY  2       // devices downloading at once
+#endif
+#ifndef PZ_FLEET_RETRIES
+  #define PZ_FLEET_RETRIES      2       // extra attempts per device
+#endif
+#ifndef PZ_FLEET_DISCOVER_MS
+  #define PZ_FLEET_DISCOVER_MS  1500    // HELLO_REQ answers collected before the first wave
+#endif
+#ifndef PZ_FLEET_ACK_MS
+  #define PZ_FLEET_ACK_MS       3000    // OTA_START -> OTA_ACK
+#endif
+#ifndef PZ_FLEET_UPDATE_MS
+  #define PZ_FLEET_UPDATE_MS    (OTA_TOTAL_MS + 30000)  // OTA_ACK -> OTA_RESULT / HELLO with new fw
+#endif
+#ifndef PZ_FLEET_RETRY_GAP_MS
+  #define PZ_FLEET_RETRY_GAP_MS 10000   // before a failed device is tried again
+#endif
+
+// --- P2P OTA over ESP-NOW (PizzaOtaP2P) ---
+#ifndef PZ_P2P_OFFER_MS
+  #define PZ_P2P_OFFER_MS       3000    // JOINs collected before streaming starts
+#endif
+#ifndef PZ_P2P_OFFER_EVERY_MS
+  #define PZ_P2P_OFFER_EVERY_MS 500     // OFFER repeat while offering (x4 while streaming)
+#endif
+#ifndef PZ_P2P_WINDOW
+  #define PZ_P2P_WINDOW         64      // chunks sent between POLLs
+#endif
+#ifndef PZ_P2P_BURST
+  #define PZ_P2P_BURST          6       // DATA frames per loop() call
+#endif
+#ifndef PZ_P2P_NACK_MS
+  #define PZ_P2P_NACK_MS        150     // server waits this long for NACKs after a POLL
+#endif
+#ifndef PZ_P2P_NACK_JITTER_MS
+  #define PZ_P2P_NACK_JITTER_MS 80      // receivers spread their NACKs over this
+#endif
+#ifndef PZ_P2P_ROUNDS
+  #define PZ_P2P_ROUNDS         4       // repair rounds per window before moving on
+#endif
+#ifndef PZ_P2P_QUIET_POLLS
+  #define PZ_P2P_QUIET_POLLS    3       // final POLLs without NACK that end a session
+#endif
+#ifndef PZ_P2P_RX_MAX
+  #define PZ_P2P_RX_MAX         PZ_PEER_MAX  // receivers tracked by a server
+#endif
+#ifndef PZ_P2P_RING
+  #define PZ_P2P_RING           16      // received chunks queued for the flash write
+#endif
+#ifndef PZ_P2P_IDLE_MS
+  #define PZ_P2P_IDLE_MS        15000   // receiver gives up after this long without frames
+#endif
+#ifndef PZ_P2P_TOTAL_MS
+  #define PZ_P2P_TOTAL_MS       600000  // server gives up after this long
+#endif
+
+// --- CRC engine (PizzaProtocol::crc16) ---
+// Every engine yields the same CRC16-CCITT-FALSE value; they only trade flash
+// for speed on the pack/unpack hot path.
+//   PZ_CRC_BITWISE  original 8-shifts-per-byte loop, no table
+//   PZ_CRC_TABLE    256-entry table (512 B flash), one lookup per byte
+//   PZ_CRC_SLICE4   slice-by-4 (2 KB flash)
+//   PZ_CRC_SLICE8   slice-by-8 (4 KB flash)
+//   PZ_CRC_ROM      ESP32 ROM crc16_be; falls back to TABLE when not present
+#define PZ_CRC_BITWISE  0
+#define PZ_CRC_TABLE    1
+#define PZ_CRC_SLICE4   2
+#define PZ_CRC_SLICE8   3
+#define PZ_CRC_ROM      4
+#ifndef PZ_CRC_ENGINE
+  #define PZ_CRC_ENGINE PZ_CRC_TABLE
+#endif
+
 // --- Network defaults (used by NetCfg compiled defaults) ---
 #ifndef WIFI_DEFAULT_SSID
   #define WIFI_DEFAULT_SSID       "AndrewiPhone"
@@ -71,12 +254,46 @@
 #ifndef OTA_RETRY_BACKOFF_MS
   #define OTA_RETRY_BACKOFF_MS  3000    // gap between attempts
 #endif
+#ifndef OTA_KEEP_ESPNOW
+  #define OTA_KEEP_ESPNOW       1       // 1: ESP-NOW stays up (on the AP channel) during STA/HTTP
+#endif
 #ifndef OTA_HTTP_CONNECT_MS
   #define OTA_HTTP_CONNECT_MS   20000   // HTTP connect timeout
 #endif
 #ifndef OTA_HTTP_TOTAL_MS
   #define OTA_HTTP_TOTAL_MS     60000   // HTTP total read timeout
 #endif
+#ifndef OTA_CHUNK_BYTES
+  #define OTA_CHUNK_BYTES       65536   // bytes per HTTP Range request
+#endif
+#ifndef OTA_CHUNK_RETRIES
+  #define OTA_CHUNK_RETRIES     6       // consecutive failed requests before giving up
+#endif
+#ifndef OTA_STALL_MS
+  #define OTA_STALL_MS          10000   // no data this long ends the current request
+#endif
+#ifndef OTA_PIPE_BUFS
+  #define OTA_PIPE_BUFS         4       // download/flash pipeline depth
+#endif
+#ifndef OTA_PIPE_BUF_BYTES
+  #define OTA_PIPE_BUF_BYTES    8192    // per buffer (PSRAM when present)
+#endif
+#ifndef OTA_WRITER_STACK_BYTES
+  // Flash writer task stack (bytes on ESP32): base-image hash check (1 KB read
+  // buffer + SHA context), decoder copy buffer, flash calls and logging.
+  #define OTA_WRITER_STACK_BYTES 8192
+#endif
+#ifndef OTA_MANIFEST_SUFFIX
+  #define OTA_MANIFEST_SUFFIX   ".manifest"   // sidecar next to the .bin, see PizzaOtaManifest.h
+#endif
+#ifndef OTA_MANIFEST_BLOCKS_MAX
+  #define OTA_MANIFEST_BLOCKS_MAX 64    // per-block hashes kept in RAM (32 B each)
+#endif
+#ifndef OTA_REQUIRE_MANIFEST
+  #define OTA_REQUIRE_MANIFEST  0       // 1: refuse images without a manifest
+#endif
+// #define PZ_OTA_PUBKEY_PEM "-----BEGIN PUBLIC KEY-----\n...\n-----END PUBLIC KEY-----\n"
+//   when defined, only manifests signed with the matching private key are accepted
 
 // --- Role-relative .bin paths (Arduino "Export compiled binary" output) ---
 // NOTE: Keep these in sync with your sketch folder names & selected boards.
@@ -97,6 +314,20 @@
 #define ACK_TIMEOUT_MS      60
 #define ACK_RETRIES         2
 #define HELLO_BACKOFF_MS    500
+
+// Reliable unicast (PizzaNow::sendReliable): retransmit after ACK_TIMEOUT_MS,
+// doubling each time, up to ACK_RETRIES resends.
+#ifndef PZ_REL_SLOTS
+  #define PZ_REL_SLOTS      8     // frames queued or in flight, all peers
+#endif
+#ifndef PZ_REL_WINDOW
+  #define PZ_REL_WINDOW     4     // max unacked frames per peer
+#endif
+// ACKs and TIME_RESP replies are queued on receive and sent from loop(), so
+// loop() must come round well within ACK_TIMEOUT_MS.
+#ifndef PZ_REPLY_SLOTS
+  #define PZ_REPLY_SLOTS    8     // replies waiting for loop(); extra ones are dropped
+#endif
 #define OTA_TOTAL_MS        120000
 
 #ifndef OTA_DONE_HOLD_MS
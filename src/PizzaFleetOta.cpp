@@ -0,0 +1,352 @@
+// File: PizzaShared/src/PizzaFleetOta.cpp
+#include "PizzaFleetOta.h"
+#include "PizzaNow.h"
+#include "PizzaUtils.h"
+#include "BuildConfig.h"
+#include <freertos/FreeRTOS.h>
+
+namespace FleetOta {
+
+static Device          s_dev[PZ_FLEET_MAX];
+static uint8_t         s_count = 0;
+static ChangeHandler   s_onChange;
+static uint8_t         s_conc  = PZ_FLEET_CONCURRENCY;
+static uint8_t         s_apCh  = 0;
+
+// Current job
+static bool            s_running    = false;
+static bool            s_discovering = false;
+static bool            s_cancelled  = false;
+static uint32_t        s_startMs    = 0;
+static uint32_t        s_helloAt    = 0;      // HELLO_REQ due (after a channel move)
+static bool            s_helloDue   = false;
+static OtaStartPayload s_job;
+static uint8_t         s_nIds       = 0;
+
+static const uint16_t  FLEET_MOVE_MS   = 250;   // moveChannel lead time
+static const uint32_t  FLEET_SETTLE_MS = 200;   // nodes retuned before HELLO_REQ
+static const uint8_t   FLEET_EVENTS    = 16;    // received messages waiting for loop()
+
+// ===== Events =====
+// handle() runs in receive context (the Wi-Fi task unless PizzaNow's RX queue
+// is on). It only copies the message here; loop() applies it, so the roster,
+// job state and onChange all stay on the loop task. s_mux guards the ring and
+// the roster append (handle() looks up MACs).
+struct Event {
+  uint8_t type;
+  uint8_t role;
+  uint8_t house_id;
+  uint8_t mac[6];
+  uint8_t payload[sizeof(HelloPayload)];
+};
+
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static Event        s_ev[FLEET_EVENTS];
+static uint8_t      s_evHead    = 0;
+static uint8_t      s_evCount   = 0;
+static uint32_t     s_evDropped = 0;
+
+// ===== Roster =====
+static Device* findMac(const uint8_t mac[6]) {
+  for (uint8_t i = 0; i < s_count; i++) {
+    if (memcmp(s_dev[i].mac, mac, 6) == 0) return &s_dev[i];
+  }
+  return nullptr;
+}
+
+static bool inJob(const Device& d) {
+  if (d.role != s_job.target_role) return false;
+  if (!s_nIds) return true;
+  for (uint8_t i = 0; i < s_nIds; i++) if (s_job.ids[i] == d.house_id) return true;
+  return false;
+}
+
+static void setState(Device& d, State st, uint32_t at = 0) {
+  d.state   = st;
+  d.stateMs = at ? at : millis();
+  if (s_onChange) s_onChange(d);
+}
+
+// Puts a device into the running job (at discovery end or when it HELLOs later).
+static void enroll(Device& d) {
+  if (!inJob(d)) { d.state = IDLE; return; }
+  d.attempts = 0;
+  d.code     = 0;
+  setState(d, strncmp(d.fw, s_job.ver, sizeof(d.fw)) == 0 ? SKIPPED : PENDING);
+}
+
+static void onHello(const Event& e) {
+  HelloPayload h;
+  memcpy(&h, e.payload, sizeof(h));
+
+  Device* d = findMac(e.mac);
+  if (!d) {
+    if (s_count >= PZ_FLEET_MAX) return;
+    Device fresh{};
+    memcpy(fresh.mac, e.mac, 6);
+    portENTER_CRITICAL(&s_mux);
+    s_dev[s_count] = fresh;
+    d = &s_dev[s_count++];
+    portEXIT_CRITICAL(&s_mux);
+  }
+  d->role     = e.role;
+  d->house_id = e.house_id;
+  d->seenMs   = millis();
+  strlcpy(d->fw, h.fw, sizeof(d->fw));
+
+  if (!s_running || s_discovering) return;
+  const bool current = strncmp(d->fw, s_job.ver, sizeof(d->fw)) == 0;
+  switch (d->state) {
+    case IDLE:     if (!s_cancelled) enroll(*d); break;
+    case PENDING:  if (current) setState(*d, SKIPPED); break;
+    case STARTING:
+    case UPDATING:
+    case FAILED:   if (current) setState(*d, DONE); break;   // rebooted into the new image
+    default: break;
+  }
+}
+
+// ===== Waves =====
+static void failAttempt(Device& d, uint8_t code) {
+  d.code = code;
+  if (++d.attempts > PZ_FLEET_RETRIES) setState(d, FAILED);
+  else                                 setState(d, PENDING, millis() + PZ_FLEET_RETRY_GAP_MS);
+}
+
+static void sendStart(Device& d) {
+  OtaStartPayload p = s_job;
+  p.target_role = d.role;
+  memset(p.ids, 0, sizeof(p.ids));
+  p.scope  = d.house_id ? 1 : 0;          // unicast anyway; LIST keeps older receivers honest
+  p.ids[0] = d.house_id;
+  setState(d, STARTING);
+  if (!PizzaNow::sendReliable(d.mac, OTA_START, &p, sizeof(p))) failAttempt(d, 0);
+}
+
+static uint8_t active() {
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < s_count; i++) {
+    if (s_dev[i].state == STARTING || s_dev[i].state == UPDATING) n++;
+  }
+  return n;
+}
+
+static void jobLoop() {
+  const uint32_t now = millis();
+  if (s_helloDue) {
+    if ((int32_t)(now - s_helloAt) < 0) return;
+    s_helloDue = false;
+    s_startMs  = now;                            // discovery window starts with the request
+    PizzaNow::sendMsg(HELLO_REQ, nullptr, 0);    // fresh fw versions before the first wave
+  }
+  if (s_discovering) {
+    if ((uint32_t)(now - s_startMs) < PZ_FLEET_DISCOVER_MS) return;
+    s_discovering = false;
+    for (uint8_t i = 0; i < s_count; i++) enroll(s_dev[i]);
+  }
+
+  for (uint8_t i = 0; i < s_count; i++) {
+    Device& d = s_dev[i];
+    if (d.state == STARTING && (uint32_t)(now - d.stateMs) >= PZ_FLEET_ACK_MS)    failAttempt(d, 0);
+    if (d.state == UPDATING && (uint32_t)(now - d.stateMs) >= PZ_FLEET_UPDATE_MS) failAttempt(d, 0);
+  }
+
+  uint8_t busy = active();
+  for (uint8_t i = 0; i < s_count && busy < s_conc && !s_cancelled; i++) {
+    Device& d = s_dev[i];
+    if (d.state != PENDING || (int32_t)(now - d.stateMs) < 0) continue;
+    sendStart(d);
+    if (d.state == STARTING) busy++;
+  }
+
+  Summary s = summary();
+  if (!s.active && (!s.pending || s_cancelled)) {
+    s_running = false;
+    PZ_LOGI("FleetOta: finished in %lus: %u done, %u skipped, %u failed%s",
+            (unsigned long)(s.elapsedMs / 1000), s.done, s.skipped, s.failed,
+            s_cancelled ? " (cancelled)" : "");
+    report();
+  }
+}
+
+// ===== API =====
+// OTA_ACK / OTA_RESULT from a tracked device.
+static void onReply(const Event& e) {
+  Device* d = findMac(e.mac);
+  if (!d) return;
+  if (e.type == OTA_ACK) {
+    OtaAckPayload a;
+    memcpy(&a, e.payload, sizeof(a));
+    if (d->state != STARTING) return;
+    if (a.accept) { d->code = a.code; setState(*d, UPDATING); }
+    else          failAttempt(*d, a.code);
+  } else {
+    OtaResultPayload r;
+    memcpy(&r, e.payload, sizeof(r));
+    if (d->state != STARTING && d->state != UPDATING) return;
+    if (r.ok) { d->code = r.code; setState(*d, DONE); }
+    else      failAttempt(*d, r.code);
+  }
+}
+
+static void queueEvent(const MsgHeader& hdr, const uint8_t* payload, uint16_t len, const uint8_t mac[6]) {
+  Event e;
+  e.type     = hdr.type;
+  e.role     = hdr.role & PZ_ROLE_MASK;
+  e.house_id = hdr.house_id;
+  memcpy(e.mac, mac, 6);
+  memset(e.payload, 0, sizeof(e.payload));
+  memcpy(e.payload, payload, len < sizeof(e.payload) ? len : sizeof(e.payload));
+
+  portENTER_CRITICAL(&s_mux);
+  if (s_evCount < FLEET_EVENTS) {
+    s_ev[(s_evHead + s_evCount) % FLEET_EVENTS] = e;
+    s_evCount++;
+  } else {
+    s_evDropped++;                       // HELLOs repeat; a lost OTA_ACK times out and retries
+  }
+  portEXIT_CRITICAL(&s_mux);
+}
+
+static bool popEvent(Event& e) {
+  portENTER_CRITICAL(&s_mux);
+  const bool have = s_evCount > 0;
+  if (have) {
+    e = s_ev[s_evHead];
+    s_evHead = (uint8_t)((s_evHead + 1) % FLEET_EVENTS);
+    s_evCount--;
+  }
+  portEXIT_CRITICAL(&s_mux);
+  return have;
+}
+
+static bool tracked(const uint8_t mac[6]) {
+  portENTER_CRITICAL(&s_mux);
+  const bool known = findMac(mac) != nullptr;
+  portEXIT_CRITICAL(&s_mux);
+  return known;
+}
+
+void begin() {
+  portENTER_CRITICAL(&s_mux);
+  memset(s_dev, 0, sizeof(s_dev));
+  s_count   = 0;
+  s_evCount = 0;
+  portEXIT_CRITICAL(&s_mux);
+  s_running = false;
+}
+
+void loop() {
+  Event e;
+  while (popEvent(e)) {
+    if (e.type == HELLO) onHello(e);
+    else                 onReply(e);
+  }
+  if (s_evDropped) {
+    PZ_LOGW("FleetOta: %lu messages dropped (event queue full)", (unsigned long)s_evDropped);
+    s_evDropped = 0;
+  }
+  if (s_running) jobLoop();
+}
+
+bool handle(const MsgHeader& hdr, const uint8_t* payload, uint16_t len, const uint8_t mac[6]) {
+  if (hdr.type == HELLO) {
+    if (len >= sizeof(HelloPayload)) queueEvent(hdr, payload, len, mac);
+    return false;
+  }
+  if (hdr.type != OTA_ACK && hdr.type != OTA_RESULT) return false;
+  if (len < 2 || !tracked(mac)) return false;
+  queueEvent(hdr, payload, len, mac);
+  return true;
+}
+
+void onChange(ChangeHandler cb) { s_onChange = cb; }
+
+bool start(uint8_t role, const char* url, const char* ver, const uint8_t* ids, uint8_t nIds) {
+  if (s_running || !url || !ver) return false;
+  if (strlen(url) >= sizeof(s_job.url) || strlen(ver) >= sizeof(s_job.ver) || nIds > sizeof(s_job.ids)) {
+    return false;
+  }
+  memset(&s_job, 0, sizeof(s_job));
+  s_job.target_role = role;
+  s_job.scope       = nIds ? 1 : 0;
+  if (nIds) memcpy(s_job.ids, ids, nIds);
+  strlcpy(s_job.url, url, sizeof(s_job.url));
+  strlcpy(s_job.ver, ver, sizeof(s_job.ver));
+  s_nIds = nIds;
+
+  for (uint8_t i = 0; i < s_count; i++) { s_dev[i].state = IDLE; s_dev[i].attempts = 0; }
+  s_running     = true;
+  s_discovering = true;
+  s_cancelled   = false;
+  s_startMs     = millis();
+  s_helloAt     = s_startMs;
+  s_helloDue    = true;
+  if (s_apCh && s_apCh != PizzaNow::channel()) {
+    if (PizzaNow::moveChannel(s_apCh, FLEET_MOVE_MS)) {
+      s_helloAt += FLEET_MOVE_MS + FLEET_SETTLE_MS;
+      PZ_LOGI("FleetOta: moving ESP-NOW to AP ch %u", s_apCh);
+    } else {
+      PZ_LOGW("FleetOta: cannot move to AP ch %u (channel discovery off); "
+              "devices drop out of reach while downloading", s_apCh);
+    }
+  }
+  PZ_LOGI("FleetOta: role %u -> v%s, %u at a time", role, ver, s_conc);
+  return true;
+}
+
+void cancel() { if (s_running) s_cancelled = true; }
+bool running() { return s_running; }
+void setConcurrency(uint8_t n) { s_conc = n ? n : 1; }
+uint8_t concurrency() { return s_conc; }
+void setApChannel(uint8_t ch) { s_apCh = ch; }
+
+Summary summary() {
+  Summary s{};
+  for (uint8_t i = 0; i < s_count; i++) {
+    switch (s_dev[i].state) {
+      case SKIPPED:  s.skipped++; break;
+      case PENDING:  s.pending++; break;
+      case STARTING:
+      case UPDATING: s.active++;  break;
+      case DONE:     s.done++;    break;
+      case FAILED:   s.failed++;  break;
+      default: break;
+    }
+  }
+  s.elapsedMs = s_startMs ? millis() - s_startMs : 0;
+  return s;
+}
+
+uint8_t count() { return s_count; }
+const Device* at(uint8_t i) { return i < s_count ? &s_dev[i] : nullptr; }
+
+const char* stateName(State s) {
+  switch (s) {
+    case IDLE:     return "-";
+    case SKIPPED:  return "SKIPPED";
+    case PENDING:  return "PENDING";
+    case STARTING: return "STARTING";
+    case UPDATING: return "UPDATING";
+    case DONE:     return "DONE";
+    case FAILED:   return "FAILED";
+    default:       return "?";
+  }
+}
+
+void report() {
+  const Summary s = summary();
+  PZ_LOGI("FleetOta: v%s %s %lus  pending=%u active=%u done=%u skipped=%u failed=%u",
+          s_job.ver, s_running ? "running" : "idle", (unsigned long)(s.elapsedMs / 1000),
+          s.pending, s.active, s.done, s.skipped, s.failed);
+  const uint32_t now = millis();
+  for (uint8_t i = 0; i < s_count; i++) {
+    const Device& d = s_dev[i];
+    if (d.state == IDLE) continue;
+    PZ_LOGI("  %02X:%02X:%02X role=%u house=%u fw=%-11s %-8s try=%u code=%u %lus",
+            d.mac[3], d.mac[4], d.mac[5], d.role, d.house_id, d.fw, stateName(d.state),
+            d.attempts, d.code, (unsigned long)((int32_t)(now - d.stateMs) > 0 ? (now - d.stateMs) / 1000 : 0));
+  }
+}
+
+} // namespace FleetOta
@@ -0,0 +1,72 @@
+// File: PizzaShared/include/PizzaFleetOta.h
+#pragma once
+#include <Arduino.h>
+#include <functional>
+#include "PizzaProtocol.h"
+
+// Central-side OTA scheduler. Instead of one broadcast OTA_START that sends
+// every device to the AP and HTTP server at once, start() collects HELLOs and
+// loop() unicasts OTA_START in waves of at most concurrency() devices. A
+// device is done when it HELLOs back with the new fw (or reports OTA_RESULT
+// ok); a NACK, OTA_RESULT failure or timeout frees its slot and it is retried
+// PZ_FLEET_RETRIES times. Devices already on the target fw are skipped.
+namespace FleetOta {
+  enum State : uint8_t {
+    IDLE,        // not part of the current job
+    SKIPPED,     // already on the target version
+    PENDING,     // waiting for a slot
+    STARTING,    // OTA_START sent, waiting for OTA_ACK
+    UPDATING,    // accepted, downloading
+    DONE,
+    FAILED,      // out of retries
+  };
+
+  struct Device {
+    uint8_t  mac[6];
+    uint8_t  role;
+    uint8_t  house_id;
+    char     fw[12];
+    State    state;
+    uint8_t  attempts;
+    uint8_t  code;         // last OTA_ACK / OTA_RESULT code
+    uint32_t seenMs;       // last HELLO
+    uint32_t stateMs;      // entered `state` / earliest retry while PENDING
+  };
+
+  struct Summary {
+    uint8_t skipped, pending, active, done, failed;
+    uint32_t elapsedMs;
+  };
+
+  typedef std::function<void(const Device&)> ChangeHandler;
+
+  void begin();
+  void loop();
+
+  // Feed every received message (safe from the receive callback); returns
+  // true for OTA_ACK / OTA_RESULT from a tracked device. HELLOs are recorded
+  // but not consumed (false). Messages take effect in the next loop().
+  bool handle(const MsgHeader& hdr, const uint8_t* payload, uint16_t len, const uint8_t mac[6]);
+  void onChange(ChangeHandler cb);               // a device changed state; called from loop()
+
+  // Updates every device of `role` (house ids in `ids`, or all when nIds == 0)
+  // to `ver` from `url`. False if a job is running or the arguments are too long.
+  bool start(uint8_t role, const char* url, const char* ver,
+             const uint8_t* ids = nullptr, uint8_t nIds = 0);
+  void cancel();                                  // stops new waves; running devices finish
+  bool running();
+  void setConcurrency(uint8_t n);
+  uint8_t concurrency();
+  // Channel of the AP the devices download through (0 = unknown, default).
+  // A device on STA follows the AP channel, so start() first moves the whole
+  // network there with PizzaNow::moveChannel (needs channel discovery) to keep
+  // OTA_ACK/OTA_RESULT reaching Central. Without it, results from devices on a
+  // different AP channel arrive only as their HELLO after the reboot.
+  void setApChannel(uint8_t ch);
+
+  Summary summary();
+  uint8_t count();                                 // devices known
+  const Device* at(uint8_t i);
+  const char* stateName(State s);
+  void report();                                   // progress table via PZ_LOGI
+}
@@ -0,0 +1,122 @@
+// File: PizzaShared/include/PizzaHost.h
+#pragma once
+// Host stand-ins for the few Arduino / IDF / FreeRTOS pieces PizzaNow uses,
+// so the real stack builds on Linux/macOS (extras/bench) and runs over a
+// PizzaSimRadio::Link. Only included when ARDUINO is not defined.
+//
+// - Clock: millis()/micros()/esp_timer_get_time() read a virtual clock the
+//   host program advances (PizzaHost::setNowUs / advanceUs); delay() advances it.
+// - Locks: one thread, so portMUX sections are no-ops and no tasks or timers
+//   are started (the RX queue and due TIMED messages run from PizzaNow::loop()).
+// - NVS: Preferences keeps values in RAM for the life of the process.
+// - Serial: log lines go to stderr so stdout stays machine-readable.
+#if defined(ARDUINO)
+  #error "PizzaHost.h is for host builds only"
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <functional>
+#include <map>
+#include <string>
+
+namespace PizzaHost {
+  inline int64_t& clockUs() { static int64_t t = 0; return t; }
+  inline void setNowUs(int64_t us)  { clockUs() = us; }
+  inline void advanceUs(int64_t us) { clockUs() += us; }
+  inline uint64_t nowUs()           { return (uint64_t)clockUs(); }
+
+  inline std::map<std::string, uint8_t>& nvs() { static std::map<std::string, uint8_t> m; return m; }
+}
+
+// ===== Clock =====
+inline int64_t  esp_timer_get_time() { return PizzaHost::clockUs(); }
+inline uint32_t millis()             { return (uint32_t)(PizzaHost::clockUs() / 1000); }
+inline uint32_t micros()             { return (uint32_t)PizzaHost::clockUs(); }
+inline void     delay(uint32_t ms)   { PizzaHost::advanceUs((int64_t)ms * 1000); }
+
+inline uint32_t esp_random() {
+  static uint32_t x = 0x9E3779B9u;            // fixed seed: runs are reproducible
+  x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+  return x;
+}
+
+// ===== Locks / tasks =====
+typedef int   portMUX_TYPE;
+typedef void* TaskHandle_t;
+typedef int   BaseType_t;
+typedef unsigned UBaseType_t;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(m) ((void)(m))
+#define portEXIT_CRITICAL(m)  ((void)(m))
+#define portMAX_DELAY         0xFFFFFFFFu
+#define pdTRUE                1
+
+inline BaseType_t xTaskCreatePinnedToCore(void (*)(void*), const char*, uint32_t, void*,
+                                          UBaseType_t, TaskHandle_t* out, BaseType_t) {
+  if (out) *out = nullptr;                    // no tasks on the host
+  return 0;
+}
+inline uint32_t ulTaskNotifyTake(BaseType_t, uint32_t) { return 0; }
+inline void     xTaskNotifyGive(TaskHandle_t) {}
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { static int self; return &self; }
+
+typedef void* SemaphoreHandle_t;
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { static int m; return &m; }
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t, uint32_t) { return pdTRUE; }
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t) { return pdTRUE; }
+
+// ===== esp_timer (no timers: callers fall back to polling) =====
+typedef int esp_err_t;
+#define ESP_OK   0
+#define ESP_FAIL -1
+typedef struct esp_timer* esp_timer_handle_t;
+struct esp_timer_create_args_t {
+  void (*callback)(void* arg);
+  void*       arg;
+  int         dispatch_method;
+  const char* name;
+  bool        skip_unhandled_events;
+};
+inline esp_err_t esp_timer_create(const esp_timer_create_args_t*, esp_timer_handle_t* out) {
+  *out = nullptr;
+  return ESP_FAIL;
+}
+inline esp_err_t esp_timer_start_once(esp_timer_handle_t, uint64_t) { return ESP_FAIL; }
+inline esp_err_t esp_timer_stop(esp_timer_handle_t) { return ESP_FAIL; }
+
+// ===== NVS =====
+class Preferences {
+ public:
+  bool begin(const char* ns, bool readOnly = false) { ns_ = ns; ro_ = readOnly; return true; }
+  void end() {}
+  uint8_t getUChar(const char* key, uint8_t def = 0) {
+    auto it = PizzaHost::nvs().find(ns_ + "/" + key);
+    return it == PizzaHost::nvs().end() ? def : it->second;
+  }
+  size_t putUChar(const char* key, uint8_t v) {
+    if (ro_) return 0;
+    PizzaHost::nvs()[ns_ + "/" + key] = v;
+    return 1;
+  }
+ private:
+  std::string ns_;
+  bool        ro_ = true;
+};
+
+// ===== Serial (logging only) =====
+struct PizzaHostSerial {
+  int printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    return n;
+  }
+  void println() { fputc('\n', stderr); }
+};
+inline PizzaHostSerial Serial;
@@ -1,6 +1,8 @@
 #pragma once
-#include <Arduino.h>
-#include <WiFi.h>
+#if defined(ARDUINO)
+  #include <Arduino.h>
+  #include <WiFi.h>
+#endif
 #include "PizzaProtocol.h"  // for Role enum
 
 #ifndef PIZZA_ROLE
@@ -18,6 +20,7 @@ namespace PizzaIdentity {
   inline uint8_t houseId()  { return (uint8_t)PIZZA_HOUSE_ID; }
   inline const char* fw()   { return FW_VERSION; }
 
+#if defined(ARDUINO)
   inline void mac(uint8_t out[6]) { WiFi.macAddress(out); }
   inline String macStr() {
     uint8_t m[6]; mac(m);
@@ -25,4 +28,5 @@ namespace PizzaIdentity {
     snprintf(buf, sizeof(buf), "%02X:%02X:%02X:%02X:%02X:%02X", m[0],m[1],m[2],m[3],m[4],m[5]);
     return String(buf);
   }
+#endif
 }
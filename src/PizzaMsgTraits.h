@@ -0,0 +1,52 @@
+// File: PizzaShared/include/PizzaMsgTraits.h
+#pragma once
+#include "PizzaProtocol.h"
+
+// Compile-time registry: MsgType -> payload struct, wire size, sender roles.
+// Used by PizzaNow::on<T>() / PizzaNow::send<T>(); a type without an entry
+// below does not compile there. Variable-length messages (ORDER_DELTA, BATCH,
+// FRAG, P2P_DATA, the compact *_C types) stay on the raw RxHandler.
+
+#define PZ_ROLE_BIT(r)  ((uint8_t)(1u << (r)))
+static const uint8_t PZ_ROLES_ANY = 0xFF;
+
+template <MsgType T> struct MsgTraits;   // undefined: type not registered
+
+#define PZ_MSG_TRAITS(TYPE, PAYLOAD, ROLES)                         \
+  template <> struct MsgTraits<TYPE> {                              \
+    typedef PAYLOAD Payload;                                        \
+    static constexpr uint16_t size  = sizeof(PAYLOAD);              \
+    static constexpr uint8_t  roles = (ROLES);                      \
+    static_assert(sizeof(PAYLOAD) <= PZ_PAYLOAD_MAX, #TYPE " payload too large"); \
+  };
+
+static const uint8_t PZ_FROM_CENTRAL = PZ_ROLE_BIT(CENTRAL);
+static const uint8_t PZ_FROM_PIZZA   = PZ_ROLE_BIT(PIZZA_NODE);
+
+PZ_MSG_TRAITS(HELLO,              HelloPayload,             PZ_ROLES_ANY)
+PZ_MSG_TRAITS(PANEL_TEXT,         PanelTextPayload,         PZ_FROM_CENTRAL)
+PZ_MSG_TRAITS(SOUND_PLAY,         SoundPlayPayload,         PZ_FROM_CENTRAL)
+PZ_MSG_TRAITS(DELIVER_SCAN,       DeliverScanPayload,       PZ_ROLES_ANY)
+PZ_MSG_TRAITS(DELIVER_RESULT,     DeliverResultPayload,     PZ_FROM_CENTRAL)
+PZ_MSG_TRAITS(OTA_START,          OtaStartPayload,          PZ_FROM_CENTRAL)
+PZ_MSG_TRAITS(OTA_ACK,            OtaAckPayload,            PZ_ROLES_ANY)
+PZ_MSG_TRAITS(OTA_RESULT,         OtaResultPayload,         PZ_ROLES_ANY)
+PZ_MSG_TRAITS(P2P_OFFER,          P2pOfferPayload,          PZ_ROLES_ANY)
+PZ_MSG_TRAITS(P2P_JOIN,           P2pJoinPayload,           PZ_ROLES_ANY)
+PZ_MSG_TRAITS(P2P_POLL,           P2pPollPayload,           PZ_ROLES_ANY)
+PZ_MSG_TRAITS(P2P_NACK,           P2pNackPayload,           PZ_ROLES_ANY)
+PZ_MSG_TRAITS(P2P_DONE,           P2pDonePayload,           PZ_ROLES_ANY)
+PZ_MSG_TRAITS(ACK_GENERIC,        AckGenericPayload,        PZ_ROLES_ANY)
+PZ_MSG_TRAITS(CLAIM,              ClaimPayload,             PZ_FROM_CENTRAL)
+PZ_MSG_TRAITS(PIZZA_ING_UPDATE,   PizzaIngrUpdatePayload,   PZ_FROM_PIZZA)
+PZ_MSG_TRAITS(PIZZA_ING_QUERY,    PizzaIngrQueryPayload,    PZ_FROM_PIZZA)
+PZ_MSG_TRAITS(PIZZA_ING_SNAPSHOT, PizzaIngrSnapshotPayload, PZ_FROM_CENTRAL)
+PZ_MSG_TRAITS(ORDER_LIST_RESET,   PzOrderListResetPayload,  PZ_FROM_CENTRAL)
+PZ_MSG_TRAITS(ORDER_ITEM_SET,     PzOrderItemSetPayload,    PZ_FROM_CENTRAL)
+PZ_MSG_TRAITS(ORDER_SHOW_TEXT,    PzOrderShowTextPayload,   PZ_FROM_CENTRAL)
+PZ_MSG_TRAITS(ORDER_SNAP_REQ,     PzOrderSnapReqPayload,    PZ_ROLES_ANY)
+PZ_MSG_TRAITS(HOUSE_DIGITAL_SET,  HouseDigitalSetPayload,   PZ_FROM_CENTRAL)
+PZ_MSG_TRAITS(ASSET_SYNC,         AssetSyncPayload,         PZ_FROM_CENTRAL)
+PZ_MSG_TRAITS(ASSET_RESULT,       AssetResultPayload,       PZ_ROLES_ANY)
+PZ_MSG_TRAITS(NET_CFG_SET,        NetCfgSetPayload,         PZ_FROM_CENTRAL)
+PZ_MSG_TRAITS(GAME_STATE,         GameStatePayload,         PZ_FROM_CENTRAL)
@@ -1,12 +1,41 @@
 #include "PizzaNow.h"
-#include <esp_idf_version.h>
-#include <esp_err.h>
+#include <atomic>
+#if defined(ARDUINO)
+  #include <esp_idf_version.h>
+  #include <esp_err.h>
+  #include <freertos/FreeRTOS.h>
+  #include <freertos/task.h>
+  #include <freertos/semphr.h>
+  #include <esp_timer.h>
+  #include <Preferences.h>
+#endif
+#include "PizzaWire.h"
 
 // Keep our handler + init flag
 static PizzaNow::RxHandler s_rx;
 static bool s_inited = false;
 static uint8_t s_channel = ESPNOW_CHANNEL;
 
+// Identity + sequence stamped into MsgHeader by sendMsg(). PIZZA_ROLE is a
+// per-sketch define this library TU never sees, so there is no usable
+// default: raw sendBroadcast()/sendUnicast() work without one, but paths that
+// stamp a header or depend on the role refuse until setIdentity() is called.
+static const uint8_t ROLE_UNSET = 0xFF;
+static Role     s_role    = (Role)ROLE_UNSET;
+static uint8_t  s_houseId = 0;
+static bool     s_roleWarned = false;
+static std::atomic<uint16_t> s_seq{0};           // bumped from loop() and receive context
+
+// False (logged once) while no role is set.
+static bool haveIdentity(const char* what) {
+  if (s_role != ROLE_UNSET) return true;
+  if (!s_roleWarned) {
+    s_roleWarned = true;
+    PZ_LOGE("PizzaNow: %s needs a role; call setIdentity() first", what);
+  }
+  return false;
+}
+
 // Broadcast MAC
 static uint8_t BROADCAST_MAC[6] = {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
 
@@ -14,70 +43,1188 @@ static uint8_t BROADCAST_MAC[6] = {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
 // devices are still transmitting legacy (unframed) packets. We print a small
 // number of "dropped non-framed" logs to make mismatches obvious.
 static uint8_t s_diagDropNonFramed = 0;
+#if defined(ARDUINO)
 static uint8_t s_diagSendErr = 0;
+#endif
 
-// ===== Wire framing =====
-// We keep this in the ESPNOW layer so application code can continue using
-// PizzaProtocol::pack/unpack unchanged.
-static inline bool stripWire(const uint8_t* in, int inLen, const uint8_t*& out, int& outLen) {
-  if (!in || inLen <= 0) return false;
-
-  // New framed packets
-  if (inLen >= 3 &&
-      in[0] == (uint8_t)PZ_WIRE_MAGIC0 &&
-      in[1] == (uint8_t)PZ_WIRE_MAGIC1 &&
-      in[2] == (uint8_t)PZ_WIRE_VERSION) {
-    out = in + 3;
-    outLen = inLen - 3;
-    return true;
+// ===== Stats =====
+#if PZ_STATS
+static uint8_t             s_statSlot[256];        // MsgType -> slot in s_stat (0 = "other")
+static uint8_t             s_statUsed = 1;
+static PizzaNow::TypeStats s_stat[PZ_STATS_TYPES];
+static uint32_t            s_stCrcFail = 0, s_stNonFramed = 0, s_stSendStatusFail = 0;
+static uint32_t            s_stOversize = 0;
+
+static portMUX_TYPE        s_statMux = portMUX_INITIALIZER_UNLOCKED;
+
+static PizzaNow::TypeStats& statFor(uint8_t type) {
+  uint8_t i = s_statSlot[type];
+  if (!i && type && s_statUsed < PZ_STATS_TYPES) {
+    portENTER_CRITICAL(&s_statMux);         // first sighting only; RX and TX may race
+    i = s_statSlot[type];
+    if (!i && s_statUsed < PZ_STATS_TYPES) {
+      i = s_statUsed;
+      s_stat[i].type = type;
+      s_statSlot[type] = i;
+      s_statUsed++;
+    }
+    portEXIT_CRITICAL(&s_statMux);
   }
+  return s_stat[i];
+}
 
-#if PZ_WIRE_RX_LEGACY
-  // Legacy packets (no wire prefix)
-  out = in;
-  outLen = inLen;
-  return true;
+static void statHandler(PizzaNow::TypeStats& st, uint32_t us) {
+  uint8_t b = us ? (uint8_t)(32 - __builtin_clz(us)) : 0;
+  if (b >= PZ_STATS_BUCKETS) b = PZ_STATS_BUCKETS - 1;
+  st.hist[b]++;
+  st.handlerTotalUs += us;
+  if (us > st.handlerMaxUs) st.handlerMaxUs = us;
+}
+  #define PZ_STAT(x) x
 #else
-  return false;
+  #define PZ_STAT(x) do {} while (0)
 #endif
+
+static uint32_t s_statsEveryMs = 0;
+static uint32_t s_statsLastMs  = 0;
+static uint8_t  s_statsDest[6];
+
+// ===== RX queue (opt-in, see PizzaNow::enableRxQueue) =====
+// Single-producer (Wi-Fi task) / single-consumer (loop() or pz_rx task) ring
+// of preallocated slots. The receive callback only checks the 3-byte wire
+// prefix (so other games' traffic cannot fill the ring) and copies the frame;
+// unpack, CRC and the user handler run later on the consumer side.
+static constexpr uint32_t    RX_TASK_STACK_BYTES = PZ_RX_TASK_STACK_BYTES;
+static constexpr UBaseType_t RX_TASK_PRIO        = 2;   // above Arduino loop task
+static constexpr BaseType_t  RX_TASK_CORE        = 1;   // keep off Wi-Fi core
+
+static_assert((PZ_RX_QUEUE_SLOTS & (PZ_RX_QUEUE_SLOTS - 1)) == 0,
+              "PZ_RX_QUEUE_SLOTS must be a power of two");
+static_assert(PizzaWire::MAX_FRAME <= 0xFF, "RxSlot::len is a uint8_t");
+
+struct RxSlot {
+  int64_t  rxUs;          // arrival time (esp_timer), for time sync
+  uint8_t  mac[6];
+  uint8_t  len;
+  uint8_t  data[PizzaWire::MAX_FRAME];
+};
+
+static RxSlot*               s_rxRing      = nullptr;
+static std::atomic<uint32_t> s_rxHead{0};               // written by producer only
+static std::atomic<uint32_t> s_rxTail{0};               // written by consumer only
+static TaskHandle_t          s_rxTask      = nullptr;
+static uint32_t              s_rxEnqueued  = 0;
+static uint32_t              s_rxDropped   = 0;
+static uint16_t              s_rxHighWater = 0;
+
+// ===== Reliable unicast state =====
+enum RelState : uint8_t { REL_FREE = 0, REL_FILLING, REL_QUEUED, REL_INFLIGHT, REL_ACKED, REL_FAILED };
+
+struct RelSlot {
+  uint8_t  state;
+  uint8_t  mac[6];
+  uint8_t  type;
+  uint8_t  tries;          // transmissions so far
+  uint8_t  len;            // wire frame bytes
+  uint16_t seq;
+  uint32_t nextAt;         // millis() of next resend (INFLIGHT)
+  uint8_t  frame[PizzaWire::MAX_FRAME];
+  PizzaNow::TxDoneHandler done;
+};
+
+// Slots are touched from loop() and from the Wi-Fi task (ACKs, send status).
+static RelSlot      s_rel[PZ_REL_SLOTS];
+static portMUX_TYPE s_relMux = portMUX_INITIALIZER_UNLOCKED;
+
+static bool sendWire(const uint8_t* mac, const uint8_t* frame, size_t len);
+static void ensurePeer(const uint8_t* mac);
+
+// ===== Reply queue =====
+// ACKs and TIME_RESP are owed on receive, which may be the Wi-Fi task. Sending
+// there would race loop() over peer registration, so receive only queues them
+// and replyService() sends from loop().
+enum ReplyKind : uint8_t { REPLY_ACK, REPLY_TIME };
+
+struct Reply {
+  uint8_t  kind;
+  uint8_t  mac[6];
+  uint8_t  type;          // ACK: acked type
+  uint16_t seq;           // ACK: acked seq
+  uint64_t t0, t1;        // TIME: request send / arrival time
+};
+
+static Reply        s_reply[PZ_REPLY_SLOTS];
+static uint8_t      s_replyHead    = 0;
+static uint8_t      s_replyCount   = 0;
+static uint32_t     s_replyDropped = 0;
+static portMUX_TYPE s_replyMux     = portMUX_INITIALIZER_UNLOCKED;
+
+static void replyQueue(const Reply& r) {
+  portENTER_CRITICAL(&s_replyMux);
+  if (s_replyCount < PZ_REPLY_SLOTS) {
+    s_reply[(s_replyHead + s_replyCount) % PZ_REPLY_SLOTS] = r;
+    s_replyCount++;
+  } else {
+    s_replyDropped++;                       // sender retries or re-probes
+  }
+  portEXIT_CRITICAL(&s_replyMux);
 }
 
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5,0,0)
-// ===== IDF 5.x callback signatures =====
-static void onRecvCB(const esp_now_recv_info* info, const uint8_t* data, int len) {
-  if (!s_rx) return;
+static void replyQueueAck(const uint8_t* mac, const MsgHeader& hdr) {
+  Reply r{};
+  r.kind = REPLY_ACK;
+  memcpy(r.mac, mac, 6);
+  r.type = hdr.type;
+  r.seq  = hdr.seq;
+  replyQueue(r);
+}
 
-  const uint8_t* inner = nullptr;
-  int innerLen = 0;
-  if (!stripWire(data, len, inner, innerLen)) {
-#if !PZ_WIRE_RX_LEGACY
-    if (s_diagDropNonFramed < 5 && data && len >= 3) {
-      PZ_LOGW("Dropped non-framed ESPNOW len=%d first=%02X %02X %02X",
-              len, data[0], data[1], data[2]);
-      s_diagDropNonFramed++;
+static void relOnAck(const uint8_t* mac, const uint8_t* payload, uint16_t len) {
+  if (len < sizeof(AckGenericPayload)) return;
+  AckGenericPayload ack; memcpy(&ack, payload, sizeof(ack));
+  portENTER_CRITICAL(&s_relMux);
+  for (RelSlot& r : s_rel) {
+    if (r.state == REL_INFLIGHT && r.seq == ack.acked_seq &&
+        r.type == ack.acked_type && memcmp(r.mac, mac, 6) == 0) {
+      r.state = REL_ACKED;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&s_relMux);
+}
+
+// Link-level failure (no MAC ACK from the peer): resend without waiting out
+// the full ACK timeout.
+static void relOnSendStatus(const uint8_t* mac, bool ok) {
+  if (ok || !mac) return;
+  const uint32_t now = millis();
+  portENTER_CRITICAL(&s_relMux);
+  for (RelSlot& r : s_rel) {
+    if (r.state == REL_INFLIGHT && memcmp(r.mac, mac, 6) == 0 &&
+        (int32_t)(r.nextAt - now) > 0) {
+      r.nextAt = now;
+    }
+  }
+  portEXIT_CRITICAL(&s_relMux);
+}
+
+static uint8_t relInflight(const uint8_t* mac) {
+  uint8_t n = 0;
+  for (const RelSlot& r : s_rel) {
+    if (r.state == REL_INFLIGHT && memcmp(r.mac, mac, 6) == 0) n++;
+  }
+  return n;
+}
+
+// Caller holds s_relMux. Wait doubles per transmission: 1x, 2x, 4x ACK_TIMEOUT_MS.
+static void relArm(RelSlot& r, uint32_t now) {
+  r.nextAt = now + ((uint32_t)ACK_TIMEOUT_MS << (r.tries < 8 ? r.tries : 8));
+  r.tries++;
+  r.state = REL_INFLIGHT;
+}
+
+// Opens the window: sends the oldest queued frame of each peer that has room.
+static void relPump() {
+  const uint32_t now = millis();
+  for (;;) {
+    RelSlot* pick = nullptr;
+    portENTER_CRITICAL(&s_relMux);
+    for (RelSlot& r : s_rel) {
+      if (r.state != REL_QUEUED) continue;
+      if (pick && (int16_t)(r.seq - pick->seq) > 0) continue;
+      if (relInflight(r.mac) >= PZ_REL_WINDOW) continue;
+      pick = &r;
+    }
+    if (pick) relArm(*pick, now);
+    portEXIT_CRITICAL(&s_relMux);
+    if (!pick) return;
+    sendWire(pick->mac, pick->frame, pick->len);
+  }
+}
+
+static void relService() {
+  const uint32_t now = millis();
+  for (RelSlot& r : s_rel) {
+    uint8_t st;
+    bool resend = false;
+    portENTER_CRITICAL(&s_relMux);
+    st = r.state;
+    if (st == REL_INFLIGHT && (int32_t)(now - r.nextAt) >= 0) {
+      if (r.tries > ACK_RETRIES) { r.state = st = REL_FAILED; }
+      else                       { relArm(r, now); resend = true; }
+    }
+    portEXIT_CRITICAL(&s_relMux);
+
+    if (resend) {
+      sendWire(r.mac, r.frame, r.len);
+    } else if (st == REL_ACKED || st == REL_FAILED) {
+      // Copy out before freeing: the handler may immediately reuse the slot.
+      PizzaNow::TxDoneHandler done = std::move(r.done);
+      uint8_t mac[6]; memcpy(mac, r.mac, 6);
+      uint16_t seq = r.seq;
+      uint8_t type = r.type;
+      r.done = nullptr;
+      portENTER_CRITICAL(&s_relMux);
+      r.state = REL_FREE;
+      portEXIT_CRITICAL(&s_relMux);
+      if (st == REL_FAILED) PZ_LOGW("reliable seq=%u type=%u gave up", (unsigned)seq, (unsigned)type);
+      if (done) done(seq, st == REL_ACKED, mac);
+    }
+  }
+  relPump();
+}
+
+// ===== Duplicate suppression =====
+// Per sender: highest seq seen (`top`) and a bitmap of the 64 seqs at and
+// below it. Only the dispatch side touches this (Wi-Fi task in direct mode,
+// consumer in queued mode), so it needs no lock.
+static_assert((PZ_DEDUP_PEERS & (PZ_DEDUP_PEERS - 1)) == 0,
+              "PZ_DEDUP_PEERS must be a power of two");
+
+struct DedupEntry {
+  uint8_t  mac[6];
+  uint8_t  role;
+  uint8_t  used;
+  uint16_t top;
+  uint32_t lastMs;
+  uint64_t seen;           // bit k = seq (top - k) already dispatched
+};
+
+static bool       s_dedupOn     = false;
+static DedupEntry s_dedup[PZ_DEDUP_PEERS];
+static uint32_t   s_dedupHits   = 0;
+static uint32_t   s_dedupMisses = 0;
+
+static DedupEntry* dedupLookup(const uint8_t* mac, uint8_t role, uint32_t now) {
+  uint32_t h = role;
+  for (int i = 0; i < 6; i++) h = h * 31u + mac[i];
+  const uint32_t mask = PZ_DEDUP_PEERS - 1;
+
+  DedupEntry* victim = nullptr;
+  for (uint32_t probe = 0; probe < PZ_DEDUP_PEERS; probe++) {
+    DedupEntry& e = s_dedup[(h + probe) & mask];
+    if (!e.used) { victim = &e; break; }
+    if (e.role == role && memcmp(e.mac, mac, 6) == 0) return &e;
+    if (!victim || (int32_t)(e.lastMs - victim->lastMs) < 0) victim = &e;
+  }
+  // Not tracked yet: take the empty slot, or evict the stalest sender.
+  memcpy(victim->mac, mac, 6);
+  victim->role   = role;
+  victim->used   = 1;
+  victim->top    = 0;
+  victim->seen   = 0;
+  victim->lastMs = now - PZ_DEDUP_TTL_MS - 1;   // forces a window reset below
+  return victim;
+}
+
+// True if (mac, role, seq) was seen within the window; records it otherwise.
+static bool dedupIsRepeat(const uint8_t* mac, uint8_t role, uint16_t seq) {
+  const uint32_t now = millis();
+  DedupEntry& e = *dedupLookup(mac, role, now);
+  const bool stale = (now - e.lastMs) > PZ_DEDUP_TTL_MS;
+  e.lastMs = now;
+
+  int16_t d = (int16_t)(seq - e.top);
+  if (stale || d <= -64) {
+    // New sender, long silence, or a seq far behind the window (sender rebooted).
+    e.top = seq; e.seen = 1;
+  } else if (d > 0) {
+    e.seen = (d >= 64) ? 1 : ((e.seen << d) | 1);
+    e.top  = seq;
+  } else {
+    uint64_t bit = (uint64_t)1 << (-d);
+    if (e.seen & bit) { s_dedupHits++; return true; }
+    e.seen |= bit;
+  }
+  s_dedupMisses++;
+  return false;
+}
+
+// ===== TX coalescing =====
+// One buffer of back-to-back packed messages per destination.
+struct TxBatch {
+  uint8_t  used;           // 1 = holds at least one message
+  uint8_t  mac[6];
+  uint8_t  count;
+  uint16_t bytes;
+  uint32_t firstAt;        // millis() of the first queued message
+  uint8_t  buf[PZ_PAYLOAD_MAX];
+};
+
+static TxBatch  s_batch[PZ_BATCH_PEERS];
+static uint32_t s_batchLost = 0;          // messages in batches the radio refused
+
+// false if the frame could not be handed to the radio (messages are dropped).
+static bool batchFlush(TxBatch& b) {
+  if (!b.used) return true;
+  uint8_t tx[PizzaWire::MAX_FRAME];
+  uint8_t pre = PizzaWire::writePrefix(tx);
+  size_t n;
+  if (b.count == 1) {
+    // A lone message goes out as itself; no container overhead.
+    memcpy(tx + pre, b.buf, b.bytes);
+    n = b.bytes;
+  } else {
+    n = PizzaProtocol::pack(BATCH, s_role, s_houseId, PizzaNow::nextSeq(), b.buf, b.bytes,
+                            tx + pre, sizeof(tx) - pre);
+  }
+  bool ok = false;
+  if (n) {
+    if (memcmp(b.mac, BROADCAST_MAC, 6) != 0) ensurePeer(b.mac);
+    ok = sendWire(b.mac, tx, pre + n);
+  }
+  if (!ok) s_batchLost += b.count;
+  b.used = 0; b.count = 0; b.bytes = 0;
+  return ok;
+}
+
+static void batchService() {
+  const uint32_t now = millis();
+  for (TxBatch& b : s_batch) {
+    if (b.used && (now - b.firstAt) >= PZ_BATCH_FLUSH_MS) batchFlush(b);
+  }
+}
+
+static TxBatch* batchFor(const uint8_t* mac) {
+  TxBatch* oldest = nullptr;
+  for (TxBatch& b : s_batch) {
+    if (b.used && memcmp(b.mac, mac, 6) == 0) return &b;
+  }
+  for (TxBatch& b : s_batch) {
+    if (!b.used) { memcpy(b.mac, mac, 6); return &b; }
+    if (!oldest || (int32_t)(b.firstAt - oldest->firstAt) < 0) oldest = &b;
+  }
+  // All buffers busy with other peers: push the oldest out early.
+  batchFlush(*oldest);
+  memcpy(oldest->mac, mac, 6);
+  return oldest;
+}
+
+// ===== Fragment reassembly =====
+// Buffers are allocated on first use. Only the dispatch side touches them;
+// expired partials are recycled lazily when a new message needs a slot.
+static_assert(PZ_FRAG_MAX_BYTES <= 32u * PZ_FRAG_DATA_MAX, "PZ_FRAG_MAX_BYTES needs > 32 slices");
+
+struct FragSlot {
+  uint8_t  used;
+  uint8_t  mac[6];
+  uint8_t  role;
+  uint8_t  houseId;
+  uint8_t  type;
+  uint8_t  count;
+  uint16_t msgId;
+  uint16_t total;
+  uint32_t got;            // bit i = slice i received
+  uint32_t startedAt;
+  uint8_t* buf;            // PZ_FRAG_MAX_BYTES
+};
+
+static FragSlot s_frag[PZ_FRAG_SLOTS];
+static uint32_t s_fragTimeouts = 0;
+
+// Recently completed messages: a slice retransmitted or duplicated after the
+// last one arrived must not open a fresh slot for an already delivered id.
+struct FragDone {
+  uint8_t  mac[6];
+  uint16_t msgId;
+  uint32_t at;             // millis() of completion, 0 = empty
+};
+
+static FragDone s_fragDone[PZ_FRAG_DONE_MEMO];
+static uint8_t  s_fragDonePos = 0;
+
+static bool fragWasDone(const uint8_t* mac, uint16_t msgId, uint32_t now) {
+  for (const FragDone& d : s_fragDone) {
+    if (d.at && d.msgId == msgId && (now - d.at) <= 2 * PZ_FRAG_TIMEOUT_MS &&
+        memcmp(d.mac, mac, 6) == 0) return true;
+  }
+  return false;
+}
+
+static void fragMarkDone(const uint8_t* mac, uint16_t msgId, uint32_t now) {
+  FragDone& d = s_fragDone[s_fragDonePos];
+  s_fragDonePos = (uint8_t)((s_fragDonePos + 1) % PZ_FRAG_DONE_MEMO);
+  memcpy(d.mac, mac, 6);
+  d.msgId = msgId;
+  d.at    = now ? now : 1;
+}
+
+static FragSlot* fragSlotFor(const uint8_t* mac, const FragHeader& fh, uint32_t now) {
+  FragSlot* freeSlot = nullptr;
+  for (FragSlot& f : s_frag) {
+    if (f.used && (now - f.startedAt) > PZ_FRAG_TIMEOUT_MS) { f.used = 0; s_fragTimeouts++; }
+    if (f.used && f.msgId == fh.msg_id && memcmp(f.mac, mac, 6) == 0) return &f;
+    if (!f.used && !freeSlot) freeSlot = &f;
+  }
+  if (!freeSlot) return nullptr;
+  if (!freeSlot->buf) {
+    freeSlot->buf = (uint8_t*)malloc(PZ_FRAG_MAX_BYTES);
+    if (!freeSlot->buf) return nullptr;
+  }
+  return freeSlot;
+}
+
+static void deliver(MsgHeader& hdr, const uint8_t* payload, uint16_t plen, const uint8_t* mac);
+
+static void dispatchFrag(const MsgHeader& outer, const uint8_t* mac, const uint8_t* p, uint16_t len) {
+  if (len < sizeof(FragHeader)) return;
+  FragHeader fh; memcpy(&fh, p, sizeof(fh));
+  const uint8_t* data = p + sizeof(fh);
+  const uint16_t dlen = len - sizeof(fh);
+  if (fh.count == 0 || fh.count > 32 || fh.index >= fh.count) return;
+  if (fh.total > PZ_FRAG_MAX_BYTES) return;
+  const uint32_t off = (uint32_t)fh.index * PZ_FRAG_DATA_MAX;
+  const uint32_t want = (fh.index + 1 == fh.count) ? (uint32_t)fh.total - off : PZ_FRAG_DATA_MAX;
+  if (off >= fh.total || dlen != want) return;
+
+  const uint32_t now = millis();
+  if (fragWasDone(mac, fh.msg_id, now)) return;  // late duplicate of a delivered message
+  FragSlot* f = fragSlotFor(mac, fh, now);
+  if (!f) return;                              // all slots busy with live messages
+  if (!f->used) {
+    f->used = 1;
+    memcpy(f->mac, mac, 6);
+    f->role = outer.role; f->houseId = outer.house_id;
+    f->type = fh.type; f->count = fh.count;
+    f->msgId = fh.msg_id; f->total = fh.total;
+    f->got = 0; f->startedAt = now;
+  } else if (f->count != fh.count || f->total != fh.total || f->type != fh.type) {
+    f->used = 0;                               // inconsistent slices: drop the message
+    return;
+  }
+
+  memcpy(f->buf + off, data, dlen);
+  f->got |= (uint32_t)1 << fh.index;
+  const uint32_t all = (f->count == 32) ? 0xFFFFFFFFu : (((uint32_t)1 << f->count) - 1);
+  if (f->got != all) return;
+
+  MsgHeader hdr{};
+  hdr.type     = f->type;
+  hdr.role     = f->role;
+  hdr.house_id = f->houseId;
+  hdr.seq      = f->msgId;
+  hdr.len      = f->total;
+  hdr.crc16    = 0;                            // each slice was CRC-checked
+  f->used = 0;
+  fragMarkDone(mac, f->msgId, now);
+  deliver(hdr, f->buf, f->total, mac);
+}
+
+// ===== Fragment send queue =====
+// sendMsg() only queues a fragmented message; fragTxService() (loop()) hands
+// the radio one slice at a time and waits for a send status before the next,
+// instead of bursting every slice into esp_now_send and running out of
+// buffers (ESP_ERR_ESPNOW_NO_MEM). FRAG_TX_WAIT_MS covers a missing status
+// (some backends report none for broadcast).
+static const uint32_t FRAG_TX_WAIT_MS = 20;
+
+struct FragTx {
+  uint8_t  mac[6];
+  uint8_t  type;
+  uint8_t  count;
+  uint8_t  next;           // next slice to send
+  uint16_t msgId;
+  uint16_t total;
+  uint32_t queuedAt;       // millis()
+  uint8_t* buf;            // PZ_FRAG_MAX_BYTES, allocated on first use
+};
+
+static FragTx            s_fragTx[PZ_FRAG_TX_SLOTS];
+static uint8_t           s_fragTxHead    = 0;
+static uint8_t           s_fragTxCount   = 0;
+static std::atomic<bool> s_fragTxBusy{false};     // slice handed over, status pending
+static uint8_t           s_fragTxMac[6];          // its destination, set before busy
+static uint32_t          s_fragTxSentAt  = 0;
+static uint32_t          s_fragTxDropped = 0;
+
+static void fragTxPop() {
+  s_fragTxHead = (uint8_t)((s_fragTxHead + 1) % PZ_FRAG_TX_SLOTS);
+  s_fragTxCount--;
+}
+
+static void fragTxService() {
+  while (s_fragTxCount) {
+    FragTx& t = s_fragTx[s_fragTxHead];
+    const uint32_t now = millis();
+    if (s_fragTxBusy.load(std::memory_order_acquire) &&
+        (now - s_fragTxSentAt) < FRAG_TX_WAIT_MS) return;
+    s_fragTxBusy.store(false, std::memory_order_relaxed);
+
+    if (t.next == t.count) { fragTxPop(); continue; }
+    if ((now - t.queuedAt) > PZ_FRAG_TIMEOUT_MS) {
+      s_fragTxDropped++;                       // a receiver would have given up on it by now
+      fragTxPop();
+      continue;
+    }
+
+    FragHeader fh{};
+    fh.type   = t.type;
+    fh.index  = t.next;
+    fh.count  = t.count;
+    fh.msg_id = t.msgId;
+    fh.total  = t.total;
+    const uint16_t off = (uint16_t)t.next * PZ_FRAG_DATA_MAX;
+    const uint16_t n   = (t.total - off) < PZ_FRAG_DATA_MAX ? (t.total - off) : PZ_FRAG_DATA_MAX;
+
+    uint8_t slice[PZ_PAYLOAD_MAX];
+    uint8_t tx[PizzaWire::MAX_FRAME];
+    memcpy(slice, &fh, sizeof(fh));
+    memcpy(slice + sizeof(fh), t.buf + off, n);
+    uint8_t pre = PizzaWire::writePrefix(tx);
+    size_t m = PizzaProtocol::pack(FRAG, s_role, s_houseId, PizzaNow::nextSeq(),
+                                   slice, sizeof(fh) + n, tx + pre, sizeof(tx) - pre);
+    if (!m) { s_fragTxDropped++; fragTxPop(); continue; }
+    // Busy before the send: the status may arrive before sendWire returns.
+    s_fragTxSentAt = now;
+    memcpy(s_fragTxMac, t.mac, 6);
+    s_fragTxBusy.store(true, std::memory_order_release);
+    if (!sendWire(t.mac, tx, pre + m)) {       // radio full: same slice on the next call
+      s_fragTxBusy.store(false, std::memory_order_relaxed);
+      return;
+    }
+    t.next++;
+    return;
+  }
+}
+
+// ===== Peer protocol versions (learned from HELLO) =====
+struct PeerProto {
+  uint8_t  mac[6];
+  uint8_t  proto;       // 0 = slot free
+  uint32_t seenMs;
+};
+
+static PeerProto s_peers[PZ_PEER_MAX];
+
+static void peerLearn(const uint8_t* mac, uint8_t proto) {
+  if (!proto) return;
+  PeerProto* slot  = nullptr;
+  PeerProto* free  = nullptr;
+  PeerProto* stale = &s_peers[0];
+  for (PeerProto& p : s_peers) {
+    if (p.proto && memcmp(p.mac, mac, 6) == 0) { slot = &p; break; }
+    if (!p.proto) { if (!free) free = &p; }
+    else if (p.seenMs < stale->seenMs) stale = &p;
+  }
+  if (!slot) slot = free ? free : stale;         // evict the stalest when full
+  memcpy(slot->mac, mac, 6);
+  slot->proto  = proto;
+  slot->seenMs = millis();
+}
+
+// Compact form of (type, payload) if `dest` can read it; broadcasts only once
+// every known peer can. Returns the compact length (0 = send as is).
+static uint16_t compactFor(uint8_t type, const void* payload, uint16_t len,
+                           const uint8_t* dest, uint8_t* out, uint8_t& outType) {
+  outType = PizzaProtocol::compactType(type);
+  if (!outType) return 0;
+  if (memcmp(dest, BROADCAST_MAC, 6) == 0) {
+    bool any = false;
+    for (const PeerProto& p : s_peers) {
+      if (!p.proto) continue;
+      if (p.proto < PZ_PROTO_COMPACT) return 0;
+      any = true;
+    }
+    if (!any) return 0;
+  } else if (PizzaNow::peerProto(dest) < PZ_PROTO_COMPACT) {
+    return 0;
+  }
+  return PizzaProtocol::encodeCompact(type, payload, len, out, PZ_PAYLOAD_MAX);
+}
+
+// ===== Typed dispatch (PizzaNow::on<T>) =====
+struct TypedSlot {
+  PizzaNow::TypedThunk thunk;
+  PizzaNow::TypedFn    fn;
+  uint16_t             minLen;
+  uint8_t              roles;
+};
+
+static TypedSlot s_typed[256];
+
+// ===== RX filter (PizzaNow::setRxFilter) =====
+static bool               s_filterOn   = false;
+static PizzaNow::RxFilter s_filter;
+static uint32_t           s_rxFiltered = 0;
+
+static inline bool maskHas(const uint32_t* m, uint8_t i) {
+  return (m[i >> 5] >> (i & 31)) & 1u;
+}
+
+// Messages whose first payload byte is the house they are meant for.
+static inline bool houseAddressed(uint8_t type) {
+  return type == PANEL_TEXT || type == PANEL_TEXT_C || type == SOUND_PLAY ||
+         type == HOUSE_DIGITAL_SET || type == ASSET_SYNC;
+}
+
+// Raw-byte check of one packed message (header + payload), before CRC.
+// Anything too short to judge passes and is left to unpack().
+static bool rxAccept(const uint8_t* msg, int len) {
+  uint8_t type = msg[offsetof(MsgHeader, type)];
+  if (type == HELLO || type == ACK_GENERIC || type == BATCH ||
+      type == TIME_BEACON || type == TIME_REQ || type == TIME_RESP ||
+      type == CHAN_PROBE || type == CHAN_ANNOUNCE) return true;
+
+  const uint8_t  role = msg[offsetof(MsgHeader, role)] & PZ_ROLE_MASK;
+  const uint8_t* p    = msg + sizeof(MsgHeader);
+  int            plen = len - (int)sizeof(MsgHeader);
+  bool frag = false;
+  if (type == FRAG) {
+    if (plen < (int)sizeof(FragHeader)) return true;
+    type = p[offsetof(FragHeader, type)];
+    frag = true;
+  } else if (type == TIMED) {
+    if (plen < (int)sizeof(PzTimedHeader)) return true;
+    type  = p[offsetof(PzTimedHeader, type)];
+    p    += sizeof(PzTimedHeader);
+    plen -= sizeof(PzTimedHeader);
+  }
+
+  if (!maskHas(s_filter.types, type)) return false;
+  if (s_filter.roles != PZ_ROLES_ANY &&
+      (role >= 8 || !(s_filter.roles & PZ_ROLE_BIT(role)))) return false;
+  if (!frag && plen > 0 && houseAddressed(type) && p[0] && !maskHas(s_filter.houses, p[0])) {
+    return false;
+  }
+  return true;
+}
+
+static inline bool rxFilteredOut(const uint8_t* msg, int len) {
+  if (!s_filterOn || rxAccept(msg, len)) return false;
+  s_rxFiltered++;
+  return true;
+}
+
+// ===== Time sync (PizzaNow::enableTimeSync) =====
+struct TsSample {
+  int64_t  offset;        // network - local
+  uint32_t rtt;
+};
+
+static bool     s_tsOn         = false;
+static bool     s_tsMaster     = false;    // Central: our clock is the network clock
+static bool     s_tsSynced     = false;
+static int64_t  s_tsOffset     = 0;        // s_tsMux: 64-bit, written in receive context
+static uint32_t s_tsRttUs      = 0;
+static int32_t  s_tsOneWayUs   = 0;
+static uint32_t s_tsSamples    = 0;
+static bool     s_tsHaveMaster = false;
+static uint8_t  s_tsMasterMac[6];
+static uint32_t s_tsLastTxMs   = 0;
+static TsSample s_tsWin[PZ_TSYNC_WINDOW];
+static uint8_t  s_tsWinN       = 0;
+static uint8_t  s_tsWinPos     = 0;
+static int64_t  s_curRxUs      = 0;        // arrival time of the frame being dispatched
+static portMUX_TYPE s_tsMux    = portMUX_INITIALIZER_UNLOCKED;
+
+// A 64-bit access is two words on the ESP32: a reader on another task could
+// see half an update and land a TIMED deadline seconds off.
+static int64_t tsOffset() {
+  portENTER_CRITICAL(&s_tsMux);
+  const int64_t off = s_tsOffset;
+  portEXIT_CRITICAL(&s_tsMux);
+  return off;
+}
+
+static void tsSetOffset(int64_t off) {
+  portENTER_CRITICAL(&s_tsMux);
+  s_tsOffset = off;
+  portEXIT_CRITICAL(&s_tsMux);
+}
+
+static void tsOnBeacon(const uint8_t* mac, const uint8_t* p, uint16_t len) {
+  TimeBeaconPayload b;
+  if (s_tsMaster || len < sizeof(b)) return;
+  memcpy(&b, p, sizeof(b));
+  memcpy(s_tsMasterMac, mac, 6);
+  s_tsHaveMaster = true;
+  if (!s_tsSamples) {                         // coarse until the first round trip
+    tsSetOffset((int64_t)b.central_us - s_curRxUs);
+    s_tsSynced = true;
+  } else {
+    s_tsOneWayUs = (int32_t)(s_curRxUs + tsOffset() - (int64_t)b.central_us);
+  }
+}
+
+static void tsOnReq(const uint8_t* mac, const uint8_t* p, uint16_t len) {
+  TimeReqPayload q;
+  if (!s_tsMaster || len < sizeof(q)) return;
+  memcpy(&q, p, sizeof(q));
+  Reply r{};
+  r.kind = REPLY_TIME;
+  memcpy(r.mac, mac, 6);
+  r.t0 = q.t0;
+  r.t1 = (uint64_t)s_curRxUs;
+  replyQueue(r);                              // t2 is stamped when it goes out
+}
+
+static void tsOnResp(const uint8_t* p, uint16_t len) {
+  TimeRespPayload r;
+  if (s_tsMaster || len < sizeof(r)) return;
+  memcpy(&r, p, sizeof(r));
+  const int64_t t3  = s_curRxUs;
+  const int64_t rtt = (t3 - (int64_t)r.t0) - (int64_t)(r.t2 - r.t1);
+  if (rtt < 0 || rtt > 1000000) return;       // stale or bogus reply
+
+  TsSample& smp = s_tsWin[s_tsWinPos];
+  smp.offset = (((int64_t)r.t1 - (int64_t)r.t0) + ((int64_t)r.t2 - t3)) / 2;
+  smp.rtt    = (uint32_t)rtt;
+  s_tsWinPos = (uint8_t)((s_tsWinPos + 1) % PZ_TSYNC_WINDOW);
+  if (s_tsWinN < PZ_TSYNC_WINDOW) s_tsWinN++;
+
+  const TsSample* best = &s_tsWin[0];
+  for (uint8_t i = 1; i < s_tsWinN; i++) {
+    if (s_tsWin[i].rtt < best->rtt) best = &s_tsWin[i];
+  }
+  tsSetOffset(best->offset);
+  s_tsRttUs  = best->rtt;
+  s_tsSynced = true;
+  s_tsSamples++;
+}
+
+// Central: beacon. Nodes: RTT probe (to Central once known, else broadcast).
+static void tsService() {
+  if (!s_tsOn || !s_inited) return;
+  const uint32_t now = millis();
+  const uint32_t every = s_tsMaster ? PZ_TSYNC_BEACON_MS : PZ_TSYNC_REQ_MS;
+  if ((uint32_t)(now - s_tsLastTxMs) < every) return;
+  s_tsLastTxMs = now;
+
+  if (s_tsMaster) {
+    TimeBeaconPayload b{ (uint64_t)esp_timer_get_time() };
+    PizzaNow::sendMsg(TIME_BEACON, &b, sizeof(b));
+  } else {
+    TimeReqPayload q{ (uint64_t)esp_timer_get_time() };
+    PizzaNow::sendMsg(TIME_REQ, &q, sizeof(q), s_tsHaveMaster ? s_tsMasterMac : nullptr);
+  }
+}
+
+// ===== Deferred TIMED delivery =====
+// Scheduled from the RX side and delivered by the dispatch context: the pz_rx
+// task when there is one, else loop(). An esp_timer one-shot (pz_timed) fires
+// at the earliest due time and only raises s_schedDue (and wakes pz_rx);
+// handlers never run on the esp_timer task. Without a timer (creation failed,
+// host builds) the dispatch context checks the heap every pass. s_schedMux
+// guards the heap and handlers run outside it; s_armLock serialises reading
+// the earliest due time with re-arming the timer.
+struct Deferred {
+  MsgHeader hdr;
+  uint8_t   mac[6];
+  uint64_t  atUs;
+};
+typedef PizzaUtils::Scheduler<PZ_SCHED_SLOTS, sizeof(Deferred) + PZ_PAYLOAD_MAX> TimedSched;
+
+static TimedSched         s_sched;
+static portMUX_TYPE       s_schedMux   = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_schedTimer = nullptr;
+static SemaphoreHandle_t  s_armLock    = nullptr;
+static std::atomic<bool>  s_schedDue{false};   // set by the timer, cleared by schedService
+
+// rxExecuteAt() per context: without pz_rx, receive-path handlers run in the
+// Wi-Fi task while deferred ones run from loop().
+static uint64_t     s_execAtRx  = 0;        // written by the receive path only
+static uint64_t     s_execAtRun = 0;        // written by runDeferred only
+static TaskHandle_t s_runTask   = nullptr;  // task inside runDeferred, if any
+
+static void handOff(MsgHeader& hdr, const uint8_t* payload, uint16_t plen, const uint8_t* mac);
+
+static void runDeferred(void*, const uint8_t* data, uint16_t len) {
+  Deferred d;
+  memcpy(&d, data, sizeof(d));
+  s_execAtRun = d.atUs;
+  s_runTask   = xTaskGetCurrentTaskHandle();
+  handOff(d.hdr, data + sizeof(d), (uint16_t)(len - sizeof(d)), d.mac);
+  s_runTask   = nullptr;
+  s_execAtRun = 0;
+}
+
+// Runs every entry due by now, each outside the lock.
+static void schedRunDue() {
+  uint8_t blob[sizeof(Deferred) + PZ_PAYLOAD_MAX];
+  for (;;) {
+    TimedSched::Fn fn; void* ctx; uint16_t len;
+    portENTER_CRITICAL(&s_schedMux);
+    const bool due = s_sched.popDue(esp_timer_get_time(), fn, ctx, blob, len);
+    portEXIT_CRITICAL(&s_schedMux);
+    if (!due) return;
+    fn(ctx, blob, len);
+  }
+}
+
+// Points the one-shot at the earliest entry (or stops it when none is left).
+static void schedArm() {
+  if (!s_schedTimer) return;
+  xSemaphoreTake(s_armLock, portMAX_DELAY);
+  portENTER_CRITICAL(&s_schedMux);
+  const int64_t next = s_sched.nextDueUs();
+  portEXIT_CRITICAL(&s_schedMux);
+  esp_timer_stop(s_schedTimer);               // ESP_ERR_INVALID_STATE when idle: fine
+  if (next != INT64_MAX) {
+    const int64_t wait = next - esp_timer_get_time();
+    esp_timer_start_once(s_schedTimer, wait > 0 ? (uint64_t)wait : 1);
+  }
+  xSemaphoreGive(s_armLock);
+}
+
+// esp_timer task: hand the work to the dispatch context.
+static void schedFire(void*) {
+  s_schedDue.store(true, std::memory_order_release);
+  if (s_rxTask) xTaskNotifyGive(s_rxTask);
+}
+
+static void schedBegin() {
+  if (s_schedTimer) return;
+  s_armLock = xSemaphoreCreateMutex();
+  if (!s_armLock) return;
+  esp_timer_create_args_t args{};
+  args.callback = schedFire;
+  args.name     = "pz_timed";
+  if (esp_timer_create(&args, &s_schedTimer) != ESP_OK) {
+    s_schedTimer = nullptr;
+    PZ_LOGW("TIMED: no esp_timer; due messages are polled");
+  }
+}
+
+// Parks a TIMED message until its local due time; false = deliver it now.
+static bool deferTimed(const MsgHeader& hdr, const uint8_t* payload, uint16_t plen,
+                       const uint8_t* mac, uint64_t atUs) {
+  if (!s_tsSynced || plen > PZ_PAYLOAD_MAX) return false;
+  const int64_t due = PizzaNow::networkToLocal(atUs);
+  if (due <= esp_timer_get_time()) return false;
+
+  uint8_t blob[sizeof(Deferred) + PZ_PAYLOAD_MAX];
+  Deferred d;
+  d.hdr  = hdr;
+  d.atUs = atUs;
+  memcpy(d.mac, mac, 6);
+  memcpy(blob, &d, sizeof(d));
+  memcpy(blob + sizeof(d), payload, plen);
+
+  portENTER_CRITICAL(&s_schedMux);
+  const bool ok = s_sched.at(due, runDeferred, nullptr, blob, (uint16_t)(sizeof(d) + plen));
+  const bool first = ok && s_sched.nextDueUs() == due;
+  portEXIT_CRITICAL(&s_schedMux);
+  if (first) schedArm();
+  return ok;                                  // full: run late rather than drop
+}
+
+// Dispatch context only (pz_rx task, else loop()): runs what the timer
+// flagged, then re-arms for the next entry.
+static void schedService() {
+  if (!s_schedTimer) { schedRunDue(); return; }
+  if (!s_schedDue.exchange(false, std::memory_order_acq_rel)) return;
+  schedRunDue();
+  schedArm();
+}
+
+// ===== Channel discovery (PizzaNow::enableChannelDiscovery) =====
+enum ChanState : uint8_t { CH_OFF, CH_SEARCH, CH_LOCKED };
+
+static const uint8_t  CH_COUNT          = 13;
+static const uint32_t CH_MOVE_REPEAT_MS = 50;   // Central re-announces a pending move
+
+static ChanState s_chState   = CH_OFF;
+static bool      s_chCentral = false;
+static uint8_t   s_chFirst   = ESPNOW_CHANNEL;  // search starts here (last good channel)
+static uint8_t   s_chStep    = 0;
+static uint32_t  s_chStepAt  = 0;
+static uint32_t  s_chHeardMs = 0;
+static uint32_t  s_chAnnAt   = 0;
+static uint8_t   s_chMoveTo  = 0;               // pending move, 0 = none
+static uint32_t  s_chMoveAt  = 0;
+static bool      s_staHold   = false;           // STA associated: radio follows the AP
+static uint8_t   s_staPrevCh = 0;
+
+// Probe/announce arrive in receive context (Wi-Fi task in direct mode); they
+// only leave a note here. Retuning, the NVS write and the probe reply happen
+// in chService() from loop().
+static portMUX_TYPE s_chMux       = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t      s_chLockReq   = 0;           // announced channel to lock on, 0 = none
+static uint8_t      s_chProbeN    = 0;           // probes since the last service call
+static uint8_t      s_chProbeMac[6];             // sender of the (only) probe
+
+static bool radioSetChannel(uint8_t ch);
+
+static void chSave(uint8_t ch) {
+  Preferences p;
+  if (!p.begin("pznow", false)) return;
+  if (p.getUChar("ch", 0) != ch) p.putUChar("ch", ch);
+  p.end();
+}
+
+static void chLock(uint8_t ch) {
+  if (ch != s_channel) radioSetChannel(ch);
+  const bool was = s_chState == CH_LOCKED;
+  s_chState  = CH_LOCKED;
+  s_chFirst  = ch;
+  s_chHeardMs = millis();
+  if (!was) {
+    PZ_LOGI("ESPNOW locked on ch %u", ch);
+    chSave(ch);
+  }
+}
+
+static void chSendAnnounce(uint8_t ch, uint16_t inMs, const uint8_t* dest) {
+  ChanAnnouncePayload a{ ch, 0, inMs };
+  PizzaNow::sendMsg(CHAN_ANNOUNCE, &a, sizeof(a), dest);
+}
+
+static void chOnProbe(const uint8_t* mac) {
+  if (!s_chCentral) return;
+  portENTER_CRITICAL(&s_chMux);
+  if (s_chProbeN < 0xFF) s_chProbeN++;
+  memcpy(s_chProbeMac, mac, 6);
+  portEXIT_CRITICAL(&s_chMux);
+}
+
+static void chOnAnnounce(const MsgHeader& hdr, const uint8_t* p, uint16_t len) {
+  ChanAnnouncePayload a;
+  if (s_chCentral || hdr.role != CENTRAL || len < sizeof(a)) return;
+  memcpy(&a, p, sizeof(a));
+  if (a.channel < 1 || a.channel > CH_COUNT) return;
+  portENTER_CRITICAL(&s_chMux);
+  if (a.in_ms) {
+    s_chMoveTo = a.channel;
+    s_chMoveAt = millis() + a.in_ms;
+  } else {
+    s_chLockReq = a.channel;                  // may be heard from an adjacent channel
+  }
+  portEXIT_CRITICAL(&s_chMux);
+}
+
+// Applies what chOnProbe/chOnAnnounce noted since the last call.
+static void chTakePending() {
+  portENTER_CRITICAL(&s_chMux);
+  const uint8_t lockCh = s_chLockReq;
+  const uint8_t probes = s_chProbeN;
+  uint8_t mac[6];
+  memcpy(mac, s_chProbeMac, 6);
+  s_chLockReq = 0;
+  s_chProbeN  = 0;
+  portEXIT_CRITICAL(&s_chMux);
+
+  if (lockCh) chLock(lockCh);
+  if (probes) {
+    // Several searchers at once: one broadcast answers them all.
+    chSendAnnounce(s_chMoveTo ? s_chMoveTo : s_channel, 0, probes == 1 ? mac : nullptr);
+  }
+}
+
+// Search order: last good channel, then 1..13 without it.
+static uint8_t chCandidate(uint8_t step) {
+  if (step == 0) return s_chFirst;
+  uint8_t ch = step;                          // 1..12
+  return ch >= s_chFirst ? ch + 1 : ch;
+}
+
+static void chStartSearch() {
+  s_chState  = CH_SEARCH;
+  s_chStep   = 0;
+  s_chStepAt = millis() - PZ_CHAN_DWELL_MS;   // probe on the next service call
+}
+
+static void chService() {
+  if (s_chState == CH_OFF || !s_inited) return;
+  chTakePending();
+  const uint32_t now = millis();
+
+  portENTER_CRITICAL(&s_chMux);
+  const uint8_t moveCh = (s_chMoveTo && (int32_t)(now - s_chMoveAt) >= 0) ? s_chMoveTo : 0;
+  if (moveCh) s_chMoveTo = 0;
+  portEXIT_CRITICAL(&s_chMux);
+  if (moveCh) {
+    radioSetChannel(moveCh);
+    if (s_chCentral) { chSave(moveCh); s_chAnnAt = now - PZ_CHAN_ANNOUNCE_MS; }
+    else             chLock(moveCh);
+    PZ_LOGI("ESPNOW moved to ch %u", moveCh);
+  }
+
+  if (s_chCentral) {
+    const uint32_t every = s_chMoveTo ? CH_MOVE_REPEAT_MS : PZ_CHAN_ANNOUNCE_MS;
+    if ((uint32_t)(now - s_chAnnAt) >= every) {
+      s_chAnnAt = now;
+      if (s_chMoveTo) chSendAnnounce(s_chMoveTo, (uint16_t)(s_chMoveAt - now), nullptr);
+      else            chSendAnnounce(s_channel, 0, nullptr);
     }
-#endif
     return;
   }
+
+  if (s_staHold) return;                      // cannot retune while on the AP
+  if (s_chState == CH_LOCKED) {
+    if ((uint32_t)(now - s_chHeardMs) >= PZ_CHAN_LOST_MS) {
+      PZ_LOGW("ESPNOW lost Central on ch %u; searching", s_channel);
+      chStartSearch();
+    }
+    return;
+  }
+
+  if ((uint32_t)(now - s_chStepAt) < PZ_CHAN_DWELL_MS) return;
+  s_chStepAt = now;
+  const uint8_t ch = chCandidate(s_chStep);
+  s_chStep = (uint8_t)((s_chStep + 1) % CH_COUNT);
+  radioSetChannel(ch);
+  ChanProbePayload probe{ ch };
+  PizzaNow::sendMsg(CHAN_PROBE, &probe, sizeof(probe));
+}
+
+// ===== RX path =====
+static void dispatchFrame(const uint8_t* mac, const uint8_t* inner, int innerLen, bool nested = false);
+
+// BATCH payload: packed messages back to back, each with its own header/CRC.
+static void dispatchBatch(const uint8_t* mac, const uint8_t* p, uint16_t len) {
+  uint16_t off = 0;
+  while (off + sizeof(MsgHeader) <= len) {
+    uint16_t recLen;
+    memcpy(&recLen, p + off + offsetof(MsgHeader, len), sizeof(recLen));
+    recLen += sizeof(MsgHeader);
+    if (off + recLen > len) return;           // truncated record
+    if (!rxFilteredOut(p + off, recLen)) dispatchFrame(mac, p + off, recLen, true);
+    off += recLen;
+  }
+}
+
+// Unpacks one de-prefixed frame and hands it to the application.
+static void dispatchFrame(const uint8_t* mac, const uint8_t* inner, int innerLen, bool nested) {
   if (innerLen < (int)sizeof(MsgHeader)) return;
 
   MsgHeader hdr; const uint8_t* payload; uint16_t plen;
-  if (!PizzaProtocol::unpack(inner, innerLen, hdr, payload, plen)) return;
-  const uint8_t* mac = info ? info->src_addr : nullptr;
-  uint8_t dummy[6] = {0,0,0,0,0,0};
-  s_rx(hdr, payload, plen, mac ? mac : dummy);
+  if (!PizzaProtocol::unpack(inner, innerLen, hdr, payload, plen)) {
+    PZ_STAT(s_stCrcFail++);
+    return;
+  }
+
+  if (hdr.role & PZ_ROLE_ACKREQ) {
+    hdr.role &= PZ_ROLE_MASK;
+    replyQueueAck(mac, hdr);  // ack repeats too: the earlier ACK may have been lost
+  }
+  if (s_dedupOn && dedupIsRepeat(mac, hdr.role, hdr.seq)) return;
+  if (hdr.type == BATCH) {
+    if (!nested) dispatchBatch(mac, payload, plen);
+    return;
+  }
+  if (hdr.type == FRAG) {
+    dispatchFrag(hdr, mac, payload, plen);
+    return;
+  }
+  deliver(hdr, payload, plen, mac);
+}
+
+// Final hop for every application message (plain, batched or reassembled).
+static void deliver(MsgHeader& hdr, const uint8_t* payload, uint16_t plen, const uint8_t* mac) {
+  uint64_t atUs = 0;                          // TIMED execution time, 0 = now
+  if (hdr.type == ACK_GENERIC) relOnAck(mac, payload, plen);
+  if (s_chState != CH_OFF) {
+    if (hdr.role == CENTRAL) s_chHeardMs = millis();
+    if (hdr.type == CHAN_PROBE)    { chOnProbe(mac); return; }
+    if (hdr.type == CHAN_ANNOUNCE) { chOnAnnounce(hdr, payload, plen); return; }
+  }
+  if (s_tsOn) {
+    switch (hdr.type) {
+      case TIME_BEACON: tsOnBeacon(mac, payload, plen); return;
+      case TIME_REQ:    tsOnReq(mac, payload, plen);    return;
+      case TIME_RESP:   tsOnResp(payload, plen);        return;
+      default: break;
+    }
+  }
+  if (hdr.type == TIMED) {
+    PzTimedHeader th;
+    if (plen < sizeof(th)) return;
+    memcpy(&th, payload, sizeof(th));
+    hdr.type = th.type;
+    payload += sizeof(th);
+    plen    -= sizeof(th);
+    hdr.len  = plen;
+    atUs     = th.at_us;
+  }
+  if (hdr.type == HELLO && plen >= sizeof(HelloPayload)) {
+    peerLearn(mac, payload[offsetof(HelloPayload, proto)]);
+  }
+
+#if PZ_COMPACT_EXPAND
+  uint8_t wide[PZ_PAYLOAD_MAX];
+  uint8_t legacy;
+  if (PizzaProtocol::legacyType(hdr.type)) {
+    uint16_t n = PizzaProtocol::expandCompact(hdr.type, payload, plen, wide, sizeof(wide), legacy);
+    if (!n) return;                           // malformed compact payload
+    hdr.type = legacy;
+    hdr.len  = n;
+    payload  = wide;
+    plen     = n;
+  }
+#endif
+
+  if (atUs && deferTimed(hdr, payload, plen, mac, atUs)) return;
+  s_execAtRx = atUs;
+  handOff(hdr, payload, plen, mac);
+  s_execAtRx = 0;
 }
-static void onSendCB(const wifi_tx_info_t* /*info*/, esp_now_send_status_t /*status*/) {
-  // hook for future ACK/retry if you want tx info
+
+// Typed handler or RxHandler for one application message.
+static void handOff(MsgHeader& hdr, const uint8_t* payload, uint16_t plen, const uint8_t* mac) {
+#if PZ_STATS
+  PizzaNow::TypeStats& st = statFor(hdr.type);
+  st.rx++;
+  const int64_t t0 = esp_timer_get_time();
+#endif
+
+  const TypedSlot& t = s_typed[hdr.type];
+  if (t.thunk) {
+    if (plen < t.minLen) return;
+    if (hdr.role >= 8 || !(t.roles & PZ_ROLE_BIT(hdr.role))) return;
+    t.thunk(t.fn, hdr, payload, mac);
+  } else if (s_rx) {
+    s_rx(hdr, payload, plen, mac);
+  }
+
+  PZ_STAT(statHandler(st, (uint32_t)(esp_timer_get_time() - t0)));
+}
+
+static bool rxEnqueue(const uint8_t* mac, const uint8_t* inner, int innerLen) {
+  const uint32_t head = s_rxHead.load(std::memory_order_relaxed);
+  const uint32_t tail = s_rxTail.load(std::memory_order_acquire);
+  if (head - tail >= PZ_RX_QUEUE_SLOTS) { s_rxDropped++; return false; }
+
+  RxSlot& slot = s_rxRing[head & (PZ_RX_QUEUE_SLOTS - 1)];
+  slot.rxUs = esp_timer_get_time();
+  memcpy(slot.mac, mac, 6);
+  slot.len = (uint8_t)innerLen;
+  memcpy(slot.data, inner, innerLen);
+  s_rxHead.store(head + 1, std::memory_order_release);
+
+  s_rxEnqueued++;
+  uint16_t depth = (uint16_t)(head + 1 - tail);
+  if (depth > s_rxHighWater) s_rxHighWater = depth;
+  if (s_rxTask) xTaskNotifyGive(s_rxTask);
+  return true;
 }
-#else
-// ===== Legacy IDF 4.x callback signatures (for older cores) =====
-static void onRecvCB(const uint8_t* mac, const uint8_t* data, int len) {
-  if (!s_rx) return;
 
+static void rxDrain() {
+  if (!s_rxRing) return;
+  // Only drain what is there now so a busy sender cannot starve the caller.
+  const uint32_t head = s_rxHead.load(std::memory_order_acquire);
+  uint32_t tail = s_rxTail.load(std::memory_order_relaxed);
+  while (tail != head) {
+    const RxSlot& slot = s_rxRing[tail & (PZ_RX_QUEUE_SLOTS - 1)];
+    s_curRxUs = slot.rxUs;
+    dispatchFrame(slot.mac, slot.data, slot.len);
+    s_rxTail.store(++tail, std::memory_order_release);
+  }
+}
+
+static void rxTask(void*) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    rxDrain();
+    schedService();
+  }
+}
+
+// Common entry for both IDF callback flavours.
+static void onFrame(const uint8_t* mac, const uint8_t* data, int len) {
   const uint8_t* inner = nullptr;
   int innerLen = 0;
-  if (!stripWire(data, len, inner, innerLen)) {
+  if (!PizzaWire::strip(data, len, inner, innerLen)) {
+    PZ_STAT(s_stNonFramed++);
 #if !PZ_WIRE_RX_LEGACY
     if (s_diagDropNonFramed < 5 && data && len >= 3) {
       PZ_LOGW("Dropped non-framed ESPNOW len=%d first=%02X %02X %02X",
@@ -88,50 +1235,260 @@ static void onRecvCB(const uint8_t* mac, const uint8_t* data, int len) {
     return;
   }
   if (innerLen < (int)sizeof(MsgHeader)) return;
+  // ESP-NOW v2 peers may send up to 1470 B; nothing of ours is that long and
+  // RxSlot (and the uint8_t length) only holds a v1-sized frame.
+  if (innerLen > (int)PizzaWire::MAX_FRAME) { PZ_STAT(s_stOversize++); return; }
+  if (rxFilteredOut(inner, innerLen)) return;
 
-  MsgHeader hdr; const uint8_t* payload; uint16_t plen;
-  if (!PizzaProtocol::unpack(inner, innerLen, hdr, payload, plen)) return;
-  uint8_t dummy[6] = {0,0,0,0,0,0};
-  s_rx(hdr, payload, plen, mac ? mac : dummy);
+  static const uint8_t kNoMac[6] = {0,0,0,0,0,0};
+  if (!mac) mac = kNoMac;
+
+  if (s_rxRing) {
+    rxEnqueue(mac, inner, innerLen);
+  } else {
+    s_curRxUs = esp_timer_get_time();
+    dispatchFrame(mac, inner, innerLen);
+  }
 }
-static void onSendCB(const uint8_t* /*mac*/, esp_now_send_status_t /*status*/) {
+
+static void onSent(const uint8_t* mac, bool ok) {
+  PZ_STAT(if (!ok) s_stSendStatusFail++);
+  relOnSendStatus(mac, ok);
+  // Only the slice's own destination releases the next slice; statuses for
+  // ACKs, beacons or batches to other peers do not. A status for another
+  // frame to the same MAC may end the wait early; FRAG_TX_WAIT_MS covers a
+  // status that never comes.
+  if (s_fragTxBusy.load(std::memory_order_acquire) && memcmp(mac, s_fragTxMac, 6) == 0) {
+    s_fragTxBusy.store(false, std::memory_order_release);
+  }
 }
-#endif
 
-namespace PizzaNow {
+// ===== ESP-NOW transport (default backend) =====
+#if defined(ARDUINO)
+static PizzaTransport::RxCB   s_espRx   = nullptr;
+static PizzaTransport::SentCB s_espSent = nullptr;
 
-bool begin(uint8_t channel) {
-  if (s_inited) return true;
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5,0,0)
+// ===== IDF 5.x callback signatures =====
+static void onRecvCB(const esp_now_recv_info* info, const uint8_t* data, int len) {
+  if (s_espRx) s_espRx(info ? info->src_addr : nullptr, data, len);
+}
+static void onSendCB(const wifi_tx_info_t* info, esp_now_send_status_t status) {
+  if (s_espSent) s_espSent(info ? info->des_addr : nullptr, status == ESP_NOW_SEND_SUCCESS);
+}
+#else
+// ===== Legacy IDF 4.x callback signatures (for older cores) =====
+static void onRecvCB(const uint8_t* mac, const uint8_t* data, int len) {
+  if (s_espRx) s_espRx(mac, data, len);
+}
+static void onSendCB(const uint8_t* mac, esp_now_send_status_t status) {
+  if (s_espSent) s_espSent(mac, status == ESP_NOW_SEND_SUCCESS);
+}
+#endif
 
-  WiFi.mode(WIFI_STA);
-  WiFi.persistent(false);
-  WiFi.disconnect(true, true);
-  delay(50);
+class EspNowTransport : public PizzaTransport {
+ public:
+  bool begin(uint8_t channel, RxCB rx, SentCB sent) override {
+    WiFi.mode(WIFI_STA);
+    WiFi.persistent(false);
+    WiFi.disconnect(true, true);
+    delay(50);
 
-  // Lock radio to our ESPNOW runtime channel
-  esp_wifi_start();
-  esp_wifi_set_ps(WIFI_PS_NONE);
-  esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
-  s_channel = channel;
+    // Lock radio to our ESPNOW runtime channel
+    esp_wifi_start();
+    esp_wifi_set_ps(WIFI_PS_NONE);
+    esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
 
-  if (esp_now_init() != ESP_OK) { PZ_LOGE("esp_now_init failed"); return false; }
+    if (esp_now_init() != ESP_OK) { PZ_LOGE("esp_now_init failed"); return false; }
 
-  // Register IDF-appropriate callbacks
-  esp_now_register_recv_cb(onRecvCB);
-  esp_now_register_send_cb(onSendCB);
+    // Register IDF-appropriate callbacks
+    s_espRx = rx;
+    s_espSent = sent;
+    esp_now_register_recv_cb(onRecvCB);
+    esp_now_register_send_cb(onSendCB);
 
-  // Add broadcast peer once
-  esp_now_peer_info_t peer{};
-  memcpy(peer.peer_addr, BROADCAST_MAC, 6);
-  peer.ifidx   = WIFI_IF_STA;
-  peer.channel = channel;
-  peer.encrypt = false;
-  {
-    esp_err_t err = esp_now_add_peer(&peer);
+    // Add broadcast peer once
+    esp_err_t err = addPeerRaw(BROADCAST_MAC, channel);
     if (err != ESP_OK && err != ESP_ERR_ESPNOW_EXIST) {
       PZ_LOGE("add broadcast peer failed: %d", (int)err);
     }
+    return true;
+  }
+
+  void end() override {
+    esp_now_deinit();
+  }
+
+  bool send(const uint8_t mac[6], const uint8_t* data, size_t len) override {
+    esp_err_t err = esp_now_send(mac, data, len);
+    if (err != ESP_OK && s_diagSendErr < 5) {
+      PZ_LOGE("esp_now_send(%s) failed: %d",
+              memcmp(mac, BROADCAST_MAC, 6) == 0 ? "BCAST" : "UNI", (int)err);
+      s_diagSendErr++;
+    }
+    return err == ESP_OK;
+  }
+
+  bool addPeer(const uint8_t mac[6], uint8_t channel) override {
+    esp_now_del_peer(mac); // idempotent
+    return addPeerRaw(mac, channel) == ESP_OK;
+  }
+
+  bool removePeer(const uint8_t mac[6]) override {
+    return esp_now_del_peer(mac) == ESP_OK;
+  }
+
+  bool hasPeer(const uint8_t mac[6]) override {
+    return esp_now_is_peer_exist(mac);
+  }
+
+  bool setChannel(uint8_t channel) override {
+    // Fails while STA is associated; then only re-pinning to the AP channel works.
+    if (esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE) != ESP_OK &&
+        radioChannel() != channel) return false;
+    // Peers are pinned to a channel; sends to them fail until they follow.
+    esp_now_peer_info_t peer{};
+    for (esp_err_t e = esp_now_fetch_peer(true, &peer); e == ESP_OK;
+         e = esp_now_fetch_peer(false, &peer)) {
+      peer.channel = channel;
+      esp_now_mod_peer(&peer);
+    }
+    return true;
+  }
+
+  uint8_t radioChannel() override {
+    uint8_t primary = 0;
+    wifi_second_chan_t second;
+    if (esp_wifi_get_channel(&primary, &second) != ESP_OK) return 0;
+    return primary;
+  }
+
+ private:
+  static esp_err_t addPeerRaw(const uint8_t* mac, uint8_t channel) {
+    esp_now_peer_info_t peer{};
+    memcpy(peer.peer_addr, mac, 6);
+    peer.ifidx   = WIFI_IF_STA;
+    peer.channel = channel;
+    peer.encrypt = false;
+    return esp_now_add_peer(&peer);
+  }
+};
+
+static EspNowTransport s_default;
+#else
+// Host builds have no radio; setTransport() a PizzaSimRadio::Link first.
+class NoTransport : public PizzaTransport {
+ public:
+  bool begin(uint8_t, RxCB, SentCB) override {
+    PZ_LOGE("no transport: call PizzaNow::setTransport() before begin()");
+    return false;
   }
+  void end() override {}
+  bool send(const uint8_t*, const uint8_t*, size_t) override { return false; }
+  bool addPeer(const uint8_t*, uint8_t) override { return false; }
+  bool removePeer(const uint8_t*) override { return false; }
+  bool hasPeer(const uint8_t*) override { return false; }
+};
+
+static NoTransport s_default;
+#endif
+static PizzaTransport* s_tp = &s_default;
+
+static bool radioSetChannel(uint8_t ch) {
+  if (!s_tp->setChannel(ch)) return false;
+  s_channel = ch;
+  return true;
+}
+
+// ===== TX helpers =====
+static bool sendWire(const uint8_t* mac, const uint8_t* frame, size_t len) {
+  const bool ok = s_tp->send(mac, frame, len);
+#if PZ_STATS
+  if (len > PizzaWire::TX_PREFIX_LEN) {
+    PizzaNow::TypeStats& st = statFor(frame[PizzaWire::TX_PREFIX_LEN]);
+    st.tx++;
+    if (!ok) st.txFail++;
+  }
+#endif
+  return ok;
+}
+
+// ESP-NOW only unicasts to registered peers; replies and reliable sends may
+// target a MAC the sketch never added.
+static void ensurePeer(const uint8_t* mac) {
+  if (!s_tp->hasPeer(mac)) s_tp->addPeer(mac, s_channel);
+}
+
+static void sendAck(const Reply& r) {
+  if (!haveIdentity("ACK")) return;
+  AckGenericPayload ack{};
+  ack.acked_type = r.type;
+  ack.code       = 0;
+  ack.acked_seq  = r.seq;
+
+  uint8_t tx[PizzaWire::MAX_FRAME];
+  uint8_t pre = PizzaWire::writePrefix(tx);
+  size_t n = PizzaProtocol::pack(ACK_GENERIC, s_role, s_houseId, PizzaNow::nextSeq(),
+                                 &ack, sizeof(ack), tx + pre, sizeof(tx) - pre);
+  if (!n) return;
+  ensurePeer(r.mac);
+  sendWire(r.mac, tx, pre + n);
+}
+
+// Sends what the receive side queued; loop() only.
+static void replyService() {
+  for (;;) {
+    Reply r;
+    portENTER_CRITICAL(&s_replyMux);
+    const bool have = s_replyCount > 0;
+    if (have) {
+      r = s_reply[s_replyHead];
+      s_replyHead = (uint8_t)((s_replyHead + 1) % PZ_REPLY_SLOTS);
+      s_replyCount--;
+    }
+    portEXIT_CRITICAL(&s_replyMux);
+    if (!have || !s_inited) return;
+
+    if (r.kind == REPLY_ACK) {
+      sendAck(r);
+    } else {
+      TimeRespPayload t;
+      t.t0 = r.t0;
+      t.t1 = r.t1;
+      t.t2 = (uint64_t)esp_timer_get_time();
+      PizzaNow::sendMsg(TIME_RESP, &t, sizeof(t), r.mac);
+    }
+  }
+}
+
+// Frames an already-packed message (legacy send API) and sends it.
+static bool sendFramed(const uint8_t* mac, const uint8_t* data, uint16_t len) {
+  if (!s_inited) return false;
+
+#if PZ_WIRE_TX_FRAMED
+  uint8_t tmp[PizzaWire::MAX_FRAME];
+  if (!data) return false;
+  if ((size_t)len + PizzaWire::TX_PREFIX_LEN > sizeof(tmp)) return false;
+  PizzaWire::writePrefix(tmp);
+  memcpy(tmp + PizzaWire::TX_PREFIX_LEN, data, len);
+  return sendWire(mac, tmp, len + PizzaWire::TX_PREFIX_LEN);
+#else
+  return sendWire(mac, data, len);
+#endif
+}
+
+namespace PizzaNow {
+
+bool begin(uint8_t channel) {
+  if (s_inited) return true;
+
+  // Random start so a rebooted sender does not replay seqs receivers still
+  // hold in their duplicate windows.
+  s_seq.store((uint16_t)esp_random(), std::memory_order_relaxed);
+
+  if (!s_tp->begin(channel, onFrame, onSent)) return false;
+  s_channel = channel;
+  schedBegin();
 
   s_inited = true;
   PZ_LOGI("ESPNOW init on ch %u OK", channel);
@@ -146,84 +1503,436 @@ bool begin(uint8_t channel) {
 
 void deinit() {
   if (!s_inited) return;
-  esp_now_deinit();
+  s_fragTxCount = 0;
+  s_fragTxBusy.store(false);
+  s_tp->end();
   s_inited = false;
 }
 
-void loop() {
-  // Future: retries/ACK mgmt
+bool setTransport(PizzaTransport* t) {
+  if (s_inited) return false;              // swap only while down
+  s_tp = t ? t : &s_default;
+  return true;
 }
 
-bool sendBroadcast(const uint8_t* data, uint16_t len) {
-  if (!s_inited) return false;
+// Builds and sends one STATS message from the current counters.
+static void statsReport() {
+#if PZ_STATS
+  uint8_t buf[sizeof(PzStatsHeader) + PZ_STATS_TYPES * sizeof(PzStatsRec)];
+  PizzaNow::RxQueueStats q;
+  PizzaNow::rxQueueStats(q);
 
-#if PZ_WIRE_TX_FRAMED
-  uint8_t tmp[256];
-  if (!data) return false;
-  if ((size_t)len + 3 > sizeof(tmp)) return false;
-  tmp[0] = (uint8_t)PZ_WIRE_MAGIC0;
-  tmp[1] = (uint8_t)PZ_WIRE_MAGIC1;
-  tmp[2] = (uint8_t)PZ_WIRE_VERSION;
-  memcpy(tmp + 3, data, len);
-  esp_err_t err = esp_now_send(BROADCAST_MAC, tmp, len + 3);
-  if (err != ESP_OK && s_diagSendErr < 5) {
-    PZ_LOGE("esp_now_send(BCAST) failed: %d", (int)err);
-    s_diagSendErr++;
-  }
-  return err == ESP_OK;
-#else
-  esp_err_t err = esp_now_send(BROADCAST_MAC, data, len);
-  if (err != ESP_OK && s_diagSendErr < 5) {
-    PZ_LOGE("esp_now_send(BCAST) failed: %d", (int)err);
-    s_diagSendErr++;
+  PzStatsHeader h{};
+  h.uptime_s   = millis() / 1000;
+  h.crc_fail   = s_stCrcFail;
+  h.non_framed = s_stNonFramed;
+  h.rx_dropped = q.dropped;
+  h.filtered   = s_rxFiltered;
+  size_t n = sizeof(h);
+  for (uint8_t i = 0; i < s_statUsed; i++) {
+    const PizzaNow::TypeStats& st = s_stat[i];
+    h.send_fail += st.txFail;
+    if (!st.tx && !st.rx) continue;
+    PzStatsRec r{};
+    r.type           = st.type;
+    r.tx_fail        = st.txFail > 0xFFFF ? 0xFFFF : (uint16_t)st.txFail;
+    r.tx             = st.tx;
+    r.rx             = st.rx;
+    r.handler_max_us = st.handlerMaxUs;
+    memcpy(buf + n, &r, sizeof(r));
+    n += sizeof(r);
+    h.count++;
   }
-  return err == ESP_OK;
+  h.send_fail += s_stSendStatusFail;
+  memcpy(buf, &h, sizeof(h));
+  PizzaNow::sendMsg(STATS, buf, (uint16_t)n, s_statsDest);
 #endif
 }
 
+void loop() {
+  s_tp->poll();
+  if (!s_rxTask) rxDrain();
+  replyService();
+  relService();
+  fragTxService();
+  batchService();
+  chService();
+  tsService();
+  if (!s_rxTask) schedService();
+  if (s_statsEveryMs && (uint32_t)(millis() - s_statsLastMs) >= s_statsEveryMs) {
+    s_statsLastMs = millis();
+    statsReport();
+  }
+}
+
+bool enableRxQueue(bool useTask) {
+  if (!s_rxRing) {
+    RxSlot* ring = (RxSlot*)calloc(PZ_RX_QUEUE_SLOTS, sizeof(RxSlot));
+    if (!ring) { PZ_LOGE("RX queue alloc failed"); return false; }
+    s_rxRing = ring;
+  }
+  if (useTask && !s_rxTask) {
+    xTaskCreatePinnedToCore(rxTask, "pz_rx", RX_TASK_STACK_BYTES,
+                            nullptr, RX_TASK_PRIO, &s_rxTask, RX_TASK_CORE);
+    if (!s_rxTask) { PZ_LOGE("RX task create failed"); return false; }
+  }
+  PZ_LOGI("RX queue on: slots=%u drain=%s",
+          (unsigned)PZ_RX_QUEUE_SLOTS, s_rxTask ? "task" : "loop");
+  return true;
+}
+
+void rxQueueStats(RxQueueStats& out) {
+  const uint32_t head = s_rxHead.load(std::memory_order_acquire);
+  const uint32_t tail = s_rxTail.load(std::memory_order_acquire);
+  out.enqueued  = s_rxEnqueued;
+  out.dropped   = s_rxDropped;
+  out.depth     = (uint16_t)(head - tail);
+  out.highWater = s_rxHighWater;
+  out.capacity  = PZ_RX_QUEUE_SLOTS;
+}
+
+bool sendBroadcast(const uint8_t* data, uint16_t len) {
+  return sendFramed(BROADCAST_MAC, data, len);
+}
+
 bool addPeer(const uint8_t mac[6]) {
   if (!s_inited) return false;
-  esp_now_peer_info_t peer{};
-  memcpy(peer.peer_addr, mac, 6);
-  peer.ifidx   = WIFI_IF_STA;
-  peer.channel = s_channel;
-  peer.encrypt = false;
-  esp_now_del_peer(mac); // idempotent
-  return esp_now_add_peer(&peer) == ESP_OK;
+  return s_tp->addPeer(mac, s_channel);
 }
 
 bool removePeer(const uint8_t mac[6]) {
   if (!s_inited) return false;
-  return esp_now_del_peer(mac) == ESP_OK;
+  return s_tp->removePeer(mac);
 }
 
 bool sendUnicast(const uint8_t mac[6], const uint8_t* data, uint16_t len) {
-  if (!s_inited) return false;
+  return sendFramed(mac, data, len);
+}
 
-#if PZ_WIRE_TX_FRAMED
-  uint8_t tmp[256];
-  if (!data) return false;
-  if ((size_t)len + 3 > sizeof(tmp)) return false;
-  tmp[0] = (uint8_t)PZ_WIRE_MAGIC0;
-  tmp[1] = (uint8_t)PZ_WIRE_MAGIC1;
-  tmp[2] = (uint8_t)PZ_WIRE_VERSION;
-  memcpy(tmp + 3, data, len);
-  esp_err_t err = esp_now_send(mac, tmp, len + 3);
-  if (err != ESP_OK && s_diagSendErr < 5) {
-    PZ_LOGE("esp_now_send(UNI) failed: %d", (int)err);
-    s_diagSendErr++;
-  }
-  return err == ESP_OK;
-#else
-  esp_err_t err = esp_now_send(mac, data, len);
-  if (err != ESP_OK && s_diagSendErr < 5) {
-    PZ_LOGE("esp_now_send(UNI) failed: %d", (int)err);
-    s_diagSendErr++;
+void setIdentity(Role role, uint8_t houseId) {
+  s_role = role;
+  s_roleWarned = false;
+  s_houseId = houseId;
+}
+
+uint16_t nextSeq() {
+  uint16_t seq;
+  do {                              // 0 is reserved as "no seq" (sendReliable failure)
+    seq = (uint16_t)(s_seq.fetch_add(1, std::memory_order_relaxed) + 1);
+  } while (seq == 0);
+  return seq;
+}
+
+// Queues a large payload as FRAG slices sharing one msg_id; the first slice
+// goes out right away, the rest from loop() (see fragTxService).
+static bool sendFragmented(uint8_t type, const uint8_t* payload, uint16_t len, const uint8_t* dest) {
+  if (!payload || len > PZ_FRAG_MAX_BYTES) return false;
+  if (s_fragTxCount >= PZ_FRAG_TX_SLOTS) return false;
+
+  FragTx& t = s_fragTx[(s_fragTxHead + s_fragTxCount) % PZ_FRAG_TX_SLOTS];
+  if (!t.buf) {
+    t.buf = (uint8_t*)malloc(PZ_FRAG_MAX_BYTES);
+    if (!t.buf) return false;
   }
-  return err == ESP_OK;
-#endif
+  memcpy(t.mac, dest, 6);
+  memcpy(t.buf, payload, len);
+  t.type      = type;
+  t.count     = (uint8_t)((len + PZ_FRAG_DATA_MAX - 1) / PZ_FRAG_DATA_MAX);
+  t.next      = 0;
+  t.msgId     = PizzaNow::nextSeq();
+  t.total     = len;
+  t.queuedAt  = millis();
+  if (memcmp(dest, BROADCAST_MAC, 6) != 0) ensurePeer(dest);
+  s_fragTxCount++;
+  fragTxService();
+  return true;
+}
+
+bool sendMsg(uint8_t type, const void* payload, uint16_t len, const uint8_t* dest) {
+  if (!s_inited || !haveIdentity("sendMsg")) return false;
+  if (!dest) dest = BROADCAST_MAC;
+
+  uint8_t compact[PZ_PAYLOAD_MAX];
+  uint8_t ctype;
+  if (uint16_t n = compactFor(type, payload, len, dest, compact, ctype)) {
+    type = ctype; payload = compact; len = n;
+  }
+  if (len > PZ_PAYLOAD_MAX) {
+    return sendFragmented(type, (const uint8_t*)payload, len, dest);
+  }
+
+  // Reserve the wire prefix and pack header+payload right behind it, so the
+  // message is built exactly once before esp_now_send copies it out.
+  uint8_t tx[PizzaWire::MAX_FRAME];
+  uint8_t pre = PizzaWire::writePrefix(tx);
+  size_t n = PizzaProtocol::pack(type, s_role, s_houseId, nextSeq(), payload, len,
+                                 tx + pre, sizeof(tx) - pre);
+  if (!n) return false;
+  if (memcmp(dest, BROADCAST_MAC, 6) != 0) ensurePeer(dest);
+  return sendWire(dest, tx, pre + n);
 }
 
 void onReceive(RxHandler cb) { s_rx = cb; }
 
+void onTyped(uint8_t type, uint16_t minLen, uint8_t roles, TypedThunk thunk, TypedFn fn) {
+  s_typed[type] = TypedSlot{ thunk, fn, minLen, roles };
+}
+
+bool queueMsg(uint8_t type, const void* payload, uint16_t len, const uint8_t* dest) {
+  if (!s_inited || !haveIdentity("queueMsg")) return false;
+  if (!dest) dest = BROADCAST_MAC;
+
+  uint8_t compact[PZ_PAYLOAD_MAX];
+  uint8_t ctype;
+  if (uint16_t n = compactFor(type, payload, len, dest, compact, ctype)) {
+    type = ctype; payload = compact; len = n;
+  }
+  if (sizeof(MsgHeader) + len > PZ_PAYLOAD_MAX) return sendMsg(type, payload, len, dest);
+
+  TxBatch* b = batchFor(dest);
+  if (b->used && b->bytes + sizeof(MsgHeader) + len > sizeof(b->buf)) batchFlush(*b);
+
+  size_t n = PizzaProtocol::pack(type, s_role, s_houseId, nextSeq(), payload, len,
+                                 b->buf + b->bytes, sizeof(b->buf) - b->bytes);
+  if (!n) return false;
+  if (!b->used) { b->used = 1; b->firstAt = millis(); memcpy(b->mac, dest, 6); }
+  b->bytes += n;
+  b->count++;
+  if (b->bytes + sizeof(MsgHeader) > sizeof(b->buf)) batchFlush(*b);   // nothing else fits
+  return true;
+}
+
+bool flush() {
+  bool ok = true;
+  for (TxBatch& b : s_batch) ok = batchFlush(b) && ok;
+  return ok;
+}
+
+uint16_t sendReliable(const uint8_t mac[6], uint8_t type, const void* payload,
+                      uint16_t len, TxDoneHandler done) {
+  if (!s_inited || !mac || !haveIdentity("sendReliable")) return 0;
+  if (memcmp(mac, BROADCAST_MAC, 6) == 0) return 0;   // nobody to ACK a broadcast
+
+  RelSlot* slot = nullptr;
+  portENTER_CRITICAL(&s_relMux);
+  for (RelSlot& r : s_rel) {
+    if (r.state == REL_FREE) { slot = &r; r.state = REL_FILLING; break; }
+  }
+  portEXIT_CRITICAL(&s_relMux);
+  if (!slot) return 0;
+
+  uint8_t compact[PZ_PAYLOAD_MAX];
+  uint8_t ctype;
+  if (uint16_t n = compactFor(type, payload, len, mac, compact, ctype)) {
+    type = ctype; payload = compact; len = n;
+  }
+
+  uint16_t seq = nextSeq();
+  uint8_t pre = PizzaWire::writePrefix(slot->frame);
+  size_t n = PizzaProtocol::pack(type, (Role)(s_role | PZ_ROLE_ACKREQ), s_houseId, seq,
+                                 payload, len, slot->frame + pre, sizeof(slot->frame) - pre);
+  if (!n) {
+    portENTER_CRITICAL(&s_relMux);
+    slot->state = REL_FREE;
+    portEXIT_CRITICAL(&s_relMux);
+    return 0;
+  }
+  memcpy(slot->mac, mac, 6);
+  slot->type  = type;
+  slot->seq   = seq;
+  slot->len   = (uint8_t)(pre + n);
+  slot->tries = 0;
+  slot->done  = done;
+  ensurePeer(mac);
+
+  portENTER_CRITICAL(&s_relMux);
+  slot->state = REL_QUEUED;
+  portEXIT_CRITICAL(&s_relMux);
+
+  relPump();
+  return seq;
+}
+
+void enableDedupe(bool on) {
+  if (on && !s_dedupOn) {
+    memset(s_dedup, 0, sizeof(s_dedup));
+    s_dedupHits = s_dedupMisses = 0;
+  }
+  s_dedupOn = on;
+}
+
+void dedupeStats(DedupeStats& out) {
+  out.hits   = s_dedupHits;
+  out.misses = s_dedupMisses;
+  out.peers  = 0;
+  for (const DedupEntry& e : s_dedup) if (e.used) out.peers++;
+}
+
+void setRxFilter(const RxFilter& f) {
+  s_filter   = f;
+  s_filterOn = true;
+}
+
+void clearRxFilter() { s_filterOn = false; }
+
+uint32_t rxFiltered() { return s_rxFiltered; }
+
+void stats(Stats& out) {
+  memset(&out, 0, sizeof(out));
+#if PZ_STATS
+  out.crcFail        = s_stCrcFail;
+  out.nonFramed      = s_stNonFramed;
+  out.sendStatusFail = s_stSendStatusFail;
+  out.rxDropped      = s_rxDropped;
+  out.oversize       = s_stOversize;
+  out.replyDropped   = s_replyDropped;
+  out.batchLost      = s_batchLost;
+  out.fragTxDropped  = s_fragTxDropped;
+  out.filtered       = s_rxFiltered;
+  out.types          = s_statUsed;
+  memcpy(out.type, s_stat, s_statUsed * sizeof(TypeStats));
+#endif
+}
+
+void resetStats() {
+#if PZ_STATS
+  for (uint8_t i = 0; i < s_statUsed; i++) {
+    const uint8_t type = s_stat[i].type;
+    memset(&s_stat[i], 0, sizeof(TypeStats));
+    s_stat[i].type = type;                  // keep the type -> slot map
+  }
+  s_stCrcFail = s_stNonFramed = s_stSendStatusFail = s_stOversize = 0;
+#endif
+  s_rxFiltered = 0;
+  s_replyDropped = 0;
+  s_batchLost    = 0;
+  s_fragTxDropped = 0;
+}
+
+void enableStatsReport(uint32_t everyMs, const uint8_t* dest) {
+  s_statsEveryMs = everyMs;
+  s_statsLastMs  = millis();
+  memcpy(s_statsDest, dest ? dest : BROADCAST_MAC, 6);
+}
+
+void enableTimeSync(bool on) {
+  if (on && s_role == ROLE_UNSET) {         // master or follower depends on the role
+    PZ_LOGE("PizzaNow::enableTimeSync: role not set; call setIdentity() first");
+    s_tsOn = false;
+    return;
+  }
+  s_tsOn       = on;
+  s_tsMaster   = (s_role == CENTRAL);
+  s_tsLastTxMs = millis() - PZ_TSYNC_REQ_MS;   // first beacon/probe on the next loop()
+  if (s_tsMaster) { tsSetOffset(0); s_tsSynced = true; }
+}
+
+uint64_t networkMicros() {
+  return (uint64_t)(esp_timer_get_time() + tsOffset());
+}
+
+bool timeSynced() { return s_tsSynced; }
+
+int64_t networkToLocal(uint64_t netUs) {
+  return (int64_t)netUs - tsOffset();
+}
+
+void timeSyncStats(TimeSyncStats& out) {
+  out.offsetUs = tsOffset();
+  out.rttUs    = s_tsRttUs;
+  out.oneWayUs = s_tsOneWayUs;
+  out.samples  = s_tsSamples;
+  out.synced   = s_tsSynced;
+}
+
+bool sendAt(uint64_t atUs, uint8_t type, const void* payload, uint16_t len, const uint8_t* dest) {
+  uint8_t buf[PZ_PAYLOAD_MAX];
+  PzTimedHeader th{ atUs, type };
+  if (sizeof(th) + len > sizeof(buf) || (len && !payload)) return false;
+  memcpy(buf, &th, sizeof(th));
+  if (len) memcpy(buf + sizeof(th), payload, len);
+  return sendMsg(TIMED, buf, (uint16_t)(sizeof(th) + len), dest);
+}
+
+uint64_t rxExecuteAt() {
+  if (s_runTask && s_runTask == xTaskGetCurrentTaskHandle()) return s_execAtRun;
+  return s_execAtRx;
+}
+
+void enableChannelDiscovery(bool on) {
+  if (!on) { s_chState = CH_OFF; s_chMoveTo = 0; s_chLockReq = 0; s_chProbeN = 0; return; }
+  if (s_role == ROLE_UNSET) {               // Central owns the channel, nodes search
+    PZ_LOGE("PizzaNow::enableChannelDiscovery: role not set; call setIdentity() first");
+    return;
+  }
+  s_chCentral = (s_role == CENTRAL);
+  if (s_chCentral) {
+    s_chState = CH_LOCKED;
+    s_chAnnAt = millis() - PZ_CHAN_ANNOUNCE_MS;   // announce on the next loop()
+    return;
+  }
+  Preferences p;
+  uint8_t last = s_channel;
+  if (p.begin("pznow", true)) { last = p.getUChar("ch", s_channel); p.end(); }
+  s_chFirst = (last >= 1 && last <= CH_COUNT) ? last : s_channel;
+  chStartSearch();
+}
+
+bool channelLocked() { return s_chState == CH_LOCKED; }
+
+uint8_t channel() { return s_channel; }
+
+void relockChannel() {
+  if (s_chState == CH_OFF || s_chCentral) return;
+  s_chFirst = s_channel;
+  chStartSearch();
+}
+
+bool moveChannel(uint8_t ch, uint16_t inMs) {
+  if (!s_chCentral || s_chState == CH_OFF || ch < 1 || ch > CH_COUNT) return false;
+  s_chMoveTo = ch;
+  s_chMoveAt = millis() + inMs;
+  s_chAnnAt  = millis() - CH_MOVE_REPEAT_MS;      // first announce on the next loop()
+  return true;
+}
+
+bool running() { return s_inited; }
+
+void beginStaWindow() {
+  if (s_staHold) return;
+  s_staHold   = true;
+  s_staPrevCh = s_channel;
+}
+
+bool adoptRadioChannel() {
+  const uint8_t ch = s_tp->radioChannel();
+  if (!ch || ch == s_channel) return true;
+  const uint8_t was = s_channel;
+  if (s_tp->setChannel(ch)) s_channel = ch;
+  PZ_LOGW("ESPNOW follows STA to ch %u; peers on ch %u are out of reach until "
+          "endStaWindow() (Central: moveChannel(%u) first)", ch, was, ch);
+  return false;
+}
+
+void endStaWindow() {
+  if (!s_staHold) return;
+  s_staHold = false;
+  if (s_staPrevCh && s_staPrevCh != s_channel) radioSetChannel(s_staPrevCh);
+  s_staPrevCh = 0;
+  relockChannel();
+}
+
+uint8_t peerProto(const uint8_t mac[6]) {
+  for (const PeerProto& p : s_peers) {
+    if (p.proto && memcmp(p.mac, mac, 6) == 0) return p.proto;
+  }
+  return 0;
+}
+
+uint8_t reliablePending() {
+  uint8_t n = 0;
+  for (const RelSlot& r : s_rel) if (r.state != REL_FREE) n++;
+  return n;
+}
+
 } // namespace PizzaNow
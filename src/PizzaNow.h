@@ -1,23 +1,267 @@
 #pragma once
-#include <Arduino.h>
-#include "PizzaProtocol.h"
 #include "PizzaUtils.h"
+#include "PizzaProtocol.h"
+#include "PizzaMsgTraits.h"
 #include "BuildConfig.h"
-#include <WiFi.h>
-#include <esp_wifi.h>
-#include <esp_now.h>
+#include "PizzaTransport.h"
+#if defined(ARDUINO)
+  #include <WiFi.h>
+  #include <esp_wifi.h>
+  #include <esp_now.h>
+#endif
 
 namespace PizzaNow {
   typedef std::function<void(const MsgHeader&, const uint8_t* payload, uint16_t len, const uint8_t srcMac[6])> RxHandler;
 
   bool begin(uint8_t channel = ESPNOW_CHANNEL);     // STA mode, ESPNOW init, set channel
   void deinit();                                    // tear down ESPNOW (for OTA window)
-  void loop();                                      // placeholder (future retries/timeouts)
+  void loop();                                      // RX queue drain, resends, completions
+
+  // Radio backend (ESP-NOW unless replaced, e.g. by a PizzaSimRadio::Link).
+  // Only while down: call before begin() or after deinit(). nullptr restores ESP-NOW.
+  bool setTransport(PizzaTransport* t);
 
   bool sendBroadcast(const uint8_t* data, uint16_t len);
   bool addPeer(const uint8_t mac[6]);
   bool removePeer(const uint8_t mac[6]);
   bool sendUnicast(const uint8_t mac[6], const uint8_t* data, uint16_t len);
 
+  // Role/house stamped into every MsgHeader built by sendMsg(). There is no
+  // default role: sendBroadcast()/sendUnicast() work without one, but
+  // sendMsg()/queueMsg()/sendReliable(), ACKs, enableTimeSync() and
+  // enableChannelDiscovery() log and refuse until this is called, e.g.
+  //   PizzaNow::setIdentity(PizzaIdentity::role(), PizzaIdentity::houseId());
+  // from the sketch (where PIZZA_ROLE is defined). Call again once a claimed
+  // house_id is loaded from NVS.
+  void setIdentity(Role role, uint8_t houseId);
+  uint16_t nextSeq();                               // per-sender MsgHeader.seq
+
+  // Builds the frame in place (wire prefix + header + payload, one copy) and
+  // sends it. dest == nullptr broadcasts. Payloads above PZ_PAYLOAD_MAX (up to
+  // PZ_FRAG_MAX_BYTES) are split into FRAG slices; receivers reassemble them
+  // and the RxHandler sees one message with hdr.len == len. Slices are paced
+  // one per send status from loop(), so true means queued; false if
+  // PZ_FRAG_TX_SLOTS messages are already waiting.
+  // PANEL_TEXT / ORDER_ITEM_SET / ORDER_SHOW_TEXT / NET_CFG_SET go out in
+  // their compact (v3) form when dest advertised proto >= PZ_PROTO_COMPACT in
+  // its HELLO (broadcast: when every peer heard from so far did).
+  bool sendMsg(uint8_t type, const void* payload, uint16_t len, const uint8_t* dest = nullptr);
+
   void onReceive(RxHandler cb);
+
+  // ===== Typed handlers (types registered in PizzaMsgTraits.h) =====
+  //   PizzaNow::on<ORDER_ITEM_SET>([](const PzOrderItemSetPayload& p) { ... });
+  // Dispatch is one lookup in a 256-entry table indexed by MsgHeader.type; a
+  // typed handler replaces the RxHandler for its type. PizzaNow checks the
+  // payload length (>= MsgTraits<T>::size) and the sender role once, here,
+  // and drops frames that fail. Plain functions / captureless lambdas only.
+  typedef void (*TypedFn)();
+  typedef void (*TypedThunk)(TypedFn fn, const MsgHeader& hdr, const uint8_t* payload,
+                             const uint8_t srcMac[6]);
+  void onTyped(uint8_t type, uint16_t minLen, uint8_t roles, TypedThunk thunk, TypedFn fn);
+
+  template <MsgType T>
+  void on(void (*fn)(const typename MsgTraits<T>::Payload&)) {
+    typedef typename MsgTraits<T>::Payload P;
+    onTyped(T, MsgTraits<T>::size, MsgTraits<T>::roles,
+            [](TypedFn f, const MsgHeader&, const uint8_t* p, const uint8_t*) {
+              P v; memcpy(&v, p, sizeof(v));
+              ((void (*)(const P&))f)(v);
+            }, (TypedFn)fn);
+  }
+
+  // Same, with the header and sender MAC.
+  template <MsgType T>
+  void on(void (*fn)(const typename MsgTraits<T>::Payload&, const MsgHeader&, const uint8_t srcMac[6])) {
+    typedef typename MsgTraits<T>::Payload P;
+    onTyped(T, MsgTraits<T>::size, MsgTraits<T>::roles,
+            [](TypedFn f, const MsgHeader& h, const uint8_t* p, const uint8_t* mac) {
+              P v; memcpy(&v, p, sizeof(v));
+              ((void (*)(const P&, const MsgHeader&, const uint8_t*))f)(v, h, mac);
+            }, (TypedFn)fn);
+  }
+
+  template <MsgType T> void off() { onTyped(T, 0, 0, nullptr, nullptr); }
+
+  // sendMsg() with the payload type checked against the registry.
+  template <MsgType T>
+  bool send(const typename MsgTraits<T>::Payload& p, const uint8_t* dest = nullptr) {
+    return sendMsg(T, &p, MsgTraits<T>::size, dest);
+  }
+
+  // ===== RX queue (opt-in) =====
+  // By default the RxHandler runs inside the ESP-NOW/Wi-Fi task. Once enabled,
+  // the receive callback only copies frames into a ring of PZ_RX_QUEUE_SLOTS
+  // preallocated slots; handlers then run from loop() (useTask=false) or from
+  // a dedicated "pz_rx" FreeRTOS task (useTask=true). Call once in setup().
+  bool enableRxQueue(bool useTask = false);
+
+  struct RxQueueStats {
+    uint32_t enqueued;    // frames accepted into the ring
+    uint32_t dropped;     // frames lost because the ring was full
+    uint16_t depth;       // frames waiting right now
+    uint16_t highWater;   // deepest the ring has been
+    uint16_t capacity;    // PZ_RX_QUEUE_SLOTS
+  };
+  void rxQueueStats(RxQueueStats& out);
+
+  // ===== Reliable unicast =====
+  // The frame carries PZ_ROLE_ACKREQ; the receiving PizzaNow answers with
+  // ACK_GENERIC {type, seq}. A failed esp_now send status or a missing ACK
+  // triggers a resend (backoff ACK_TIMEOUT_MS, x2 per try, ACK_RETRIES times).
+  // At most PZ_REL_WINDOW frames per peer are in flight; the rest wait in
+  // order. `done` runs from loop() once the frame is acked or given up on.
+  // Returns the MsgHeader.seq used, or 0 if the pool is full.
+  typedef std::function<void(uint16_t seq, bool ok, const uint8_t mac[6])> TxDoneHandler;
+  uint16_t sendReliable(const uint8_t mac[6], uint8_t type, const void* payload,
+                        uint16_t len, TxDoneHandler done = nullptr);
+  uint8_t  reliablePending();                       // queued + in flight
+
+  // ===== TX coalescing =====
+  // Like sendMsg(), but parks the message in a per-destination batch. The
+  // batch goes out as one BATCH frame when the next message would not fit,
+  // PZ_BATCH_FLUSH_MS after its first message (from loop()), or on flush().
+  // Receivers unpack BATCH transparently: the RxHandler still sees one call
+  // per message. Only batch towards devices running this PizzaNow; older
+  // firmware ignores BATCH frames.
+  // A batch the radio refuses is dropped and counted in Stats::batchLost.
+  bool queueMsg(uint8_t type, const void* payload, uint16_t len, const uint8_t* dest = nullptr);
+  bool flush();                                     // false if any batch was refused
+
+  // ===== Duplicate suppression (opt-in) =====
+  // Drops frames whose (src MAC, role, seq) was already dispatched recently,
+  // so broadcast repeats, resends whose ACK got lost, and radio echoes reach
+  // the RxHandler once. ACK requests are still answered for duplicates.
+  // Only enable once every sender stamps a real per-sender seq (sendMsg /
+  // sendReliable do; hand-packed frames must too).
+  void enableDedupe(bool on);
+
+  struct DedupeStats {
+    uint32_t hits;        // duplicates dropped
+    uint32_t misses;      // first sightings passed on
+    uint8_t  peers;       // senders currently tracked
+  };
+  void dedupeStats(DedupeStats& out);
+
+  // ===== RX filter (opt-in) =====
+  // Checked against the raw header bytes in the receive callback, before the
+  // RX queue, CRC and unpack, so frames meant for other devices cost a few
+  // loads. A frame passes when its type, its sender role and - for messages
+  // addressed to one house (PANEL_TEXT(_C), SOUND_PLAY, HOUSE_DIGITAL_SET,
+  // ASSET_SYNC) - the target house_id in its payload are all accepted. Target
+  // house 0 means "every house" and always passes. HELLO, ACK_GENERIC and
+  // BATCH always pass; BATCH records are filtered one by one and FRAG slices
+  // by the type they carry.
+  //   RxFilter f; f.acceptAll(); f.clearHouses(); f.acceptHouse(myHouse);
+  struct RxFilter {
+    uint32_t types[8];    // bit per MsgType
+    uint32_t houses[8];   // bit per target house_id
+    uint8_t  roles;       // PZ_ROLE_BIT(sender role)
+
+    void acceptAll()            { memset(this, 0xFF, sizeof(*this)); }
+    void clearTypes()           { memset(types, 0, sizeof(types)); }
+    void clearHouses()          { memset(houses, 0, sizeof(houses)); }
+    void clearRoles()           { roles = 0; }
+    void acceptType(uint8_t t)  { types[t >> 5]  |= 1u << (t & 31); }
+    void acceptHouse(uint8_t h) { houses[h >> 5] |= 1u << (h & 31); }
+    void acceptRole(Role r)     { roles |= PZ_ROLE_BIT(r); }
+  };
+  void setRxFilter(const RxFilter& f);
+  void clearRxFilter();                             // accept everything again
+  uint32_t rxFiltered();                            // frames rejected so far
+
+  // ===== Stats =====
+  // Always-on counters (compile out with PZ_STATS 0). Per MsgType: frames sent
+  // (incl. resends), refused sends, messages delivered, and a log2 histogram
+  // of handler time (typed handler or RxHandler, esp_timer_get_time). The
+  // first PZ_STATS_TYPES types seen get their own slot; the rest share slot 0
+  // (type 0). Counters are updated without locks and may be off by one under
+  // concurrent RX/TX.
+  struct TypeStats {
+    uint8_t  type;
+    uint32_t tx, txFail, rx;
+    uint32_t handlerTotalUs, handlerMaxUs;
+    uint32_t hist[PZ_STATS_BUCKETS];    // bucket i: handler took < 2^i us (last: the rest)
+  };
+  struct Stats {
+    uint32_t crcFail;         // failed unpack (CRC or length)
+    uint32_t nonFramed;       // missing wire prefix
+    uint32_t sendStatusFail;  // radio reported delivery failure
+    uint32_t rxDropped;       // RX queue full
+    uint32_t oversize;        // framed but longer than PizzaWire::MAX_FRAME
+    uint32_t replyDropped;    // ACK/TIME_RESP not sent: reply queue full
+    uint32_t batchLost;       // queueMsg() messages in a BATCH the radio refused
+    uint32_t fragTxDropped;   // fragmented sends abandoned before the last slice
+    uint32_t filtered;        // rejected by the RX filter
+    uint8_t  types;           // valid entries in type[]
+    TypeStats type[PZ_STATS_TYPES];
+  };
+  void stats(Stats& out);
+  void resetStats();
+
+  // Sends a STATS summary every `everyMs` from loop() (0 = off) to `dest`
+  // (nullptr: broadcast; Central picks it up in its RxHandler).
+  void enableStatsReport(uint32_t everyMs, const uint8_t* dest = nullptr);
+
+  // ===== Time sync (opt-in) =====
+  // Central's esp_timer is the network clock. Central broadcasts TIME_BEACON
+  // every PZ_TSYNC_BEACON_MS; other nodes adopt it on the first beacon, then
+  // refine it with TIME_REQ/TIME_RESP round trips (PZ_TSYNC_REQ_MS) and keep
+  // the offset of the lowest-RTT sample in the last PZ_TSYNC_WINDOW. Once an
+  // RTT sample exists, each beacon also yields the one-way latency from Central.
+  void     enableTimeSync(bool on);
+  uint64_t networkMicros();                         // local clock until synced
+  bool     timeSynced();
+  int64_t  networkToLocal(uint64_t netUs);          // esp_timer_get_time() value at netUs
+
+  struct TimeSyncStats {
+    int64_t  offsetUs;    // network - local
+    uint32_t rttUs;       // RTT of the sample in use
+    int32_t  oneWayUs;    // Central -> here, from the last beacon
+    uint32_t samples;     // RTT exchanges completed
+    bool     synced;
+  };
+  void timeSyncStats(TimeSyncStats& out);
+
+  // Sends (type, payload) wrapped in TIMED so receivers act on it at network
+  // time atUs. Handlers see the inner type; rxExecuteAt() returns atUs.
+  // A synced receiver holds the message (up to PZ_SCHED_SLOTS); an esp_timer
+  // one-shot flags it due at atUs and the handler runs from the pz_rx task
+  // (enableRxQueue(true)) or else loop(), so loop() latency adds to the
+  // deadline. Late or unsynced ones run immediately.
+  bool sendAt(uint64_t atUs, uint8_t type, const void* payload, uint16_t len,
+              const uint8_t* dest = nullptr);
+  uint64_t rxExecuteAt();                           // in a handler: TIMED time, 0 = now
+
+  // ===== Channel discovery (opt-in) =====
+  // Central announces its channel (CHAN_ANNOUNCE every PZ_CHAN_ANNOUNCE_MS)
+  // and answers CHAN_PROBE. Other nodes start on the last channel that worked
+  // (NVS), probe, and step through 1..13 (PZ_CHAN_DWELL_MS each) until Central
+  // answers; they search again after PZ_CHAN_LOST_MS without hearing Central.
+  // Retuning, the NVS write and probe replies all run from loop(), so
+  // Central's loop() must come round well within PZ_CHAN_DWELL_MS.
+  void    enableChannelDiscovery(bool on);
+  bool    channelLocked();                          // Central heard on channel()
+  uint8_t channel();
+  void    relockChannel();                          // node: search now (e.g. after Wi-Fi STA)
+  // Central: tell nodes, then move everyone to `ch` after inMs.
+  bool    moveChannel(uint8_t ch, uint16_t inMs = 250);
+
+  // ===== Wi-Fi STA sessions =====
+  // ESP-NOW keeps working while STA is associated, but only on the AP's
+  // channel: peers left on another channel do not hear us and we do not hear
+  // them. beginStaWindow() before connecting pauses channel search; after
+  // connect, adoptRadioChannel() moves PizzaNow (peers, channel()) to the AP
+  // channel and returns false (with a warning) if that left the channel the
+  // rest of the network uses. Central avoids that by moving everyone first
+  // (moveChannel; FleetOta::setApChannel does it before an update).
+  // endStaWindow() after disconnect returns to the previous channel and, with
+  // discovery on, re-locks onto Central. PizzaOta does this when OTA_KEEP_ESPNOW.
+  bool running();
+  void beginStaWindow();
+  bool adoptRadioChannel();
+  void endStaWindow();
+
+  // Protocol version from the peer's last HELLO, 0 if never heard from.
+  uint8_t peerProto(const uint8_t mac[6]);
 }
@@ -0,0 +1,351 @@
+// File: PizzaShared/src/PizzaOrders.cpp
+#include "PizzaOrders.h"
+#include "PizzaNow.h"
+#include "BuildConfig.h"
+#include <freertos/FreeRTOS.h>
+
+namespace PizzaOrders {
+
+struct Entry {
+  Order   o;
+  uint8_t used;    // live order
+  uint8_t dirty;   // owner: changed since the last delta (used=0: removed)
+};
+
+static const size_t DELTA_MAX =
+    sizeof(PzOrderDeltaHeader) + PZ_ORDERS_MAX * (sizeof(PzOrderDeltaRec) + PZ_ORDER_TEXT_MAX);
+static_assert(DELTA_MAX <= PZ_FRAG_MAX_BYTES, "full order table must fit one (fragmented) message");
+
+static Entry         s_tab[PZ_ORDERS_MAX];
+static bool          s_owner    = false;
+static uint16_t      s_gen      = 0;
+static ChangeHandler s_onChange;
+
+// Owner
+static bool          s_fullPending = false;   // clear(): next delta replaces the table
+static bool          s_snapPending = false;   // s_mux
+static uint8_t       s_snapMac[6];            // s_mux
+static uint32_t      s_lastTxMs    = 0;
+
+// Station
+static bool          s_synced      = false;
+static bool          s_needSnap    = false;
+static bool          s_haveOwner   = false;
+static uint8_t       s_ownerMac[6];
+static uint32_t      s_lastReqMs   = 0;
+
+static const uint8_t BROADCAST[6] = {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
+
+// ===== Received deltas =====
+// handle() runs in receive context (the Wi-Fi task unless PizzaNow's RX queue
+// is on). It only copies ORDER_DELTA here and notes ORDER_SNAP_REQ; loop()
+// applies them, so the table, generation and onChange stay on the loop task.
+// A full ring drops the delta: the next one no longer builds on s_gen and the
+// station asks for a snapshot.
+static const uint8_t ORDERS_RX_SLOTS = 2;
+
+struct RxDelta {
+  uint8_t  mac[6];
+  uint16_t len;
+  uint8_t  data[DELTA_MAX];
+};
+
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static RxDelta      s_rxq[ORDERS_RX_SLOTS];
+static uint8_t      s_rxHead  = 0;
+static uint8_t      s_rxCount = 0;
+
+static void queueDelta(const uint8_t* p, uint16_t len, const uint8_t mac[6]) {
+  if (len > DELTA_MAX) return;
+  portENTER_CRITICAL(&s_mux);
+  if (s_rxCount < ORDERS_RX_SLOTS) {
+    RxDelta& d = s_rxq[(s_rxHead + s_rxCount) % ORDERS_RX_SLOTS];
+    memcpy(d.mac, mac, 6);
+    d.len = len;
+    memcpy(d.data, p, len);
+    s_rxCount++;
+  }
+  portEXIT_CRITICAL(&s_mux);
+}
+
+// Copies the oldest delta out so the slot is free before it is applied.
+static bool popDelta(RxDelta& out) {
+  portENTER_CRITICAL(&s_mux);
+  const bool have = s_rxCount > 0;
+  if (have) {
+    out = s_rxq[s_rxHead];
+    s_rxHead = (uint8_t)((s_rxHead + 1) % ORDERS_RX_SLOTS);
+    s_rxCount--;
+  }
+  portEXIT_CRITICAL(&s_mux);
+  return have;
+}
+
+// Two requesters before the next answer: serve both with one broadcast.
+static void noteSnapReq(const uint8_t mac[6]) {
+  portENTER_CRITICAL(&s_mux);
+  if (s_snapPending && memcmp(s_snapMac, mac, 6) != 0) memcpy(s_snapMac, BROADCAST, 6);
+  else if (!s_snapPending) memcpy(s_snapMac, mac, 6);
+  s_snapPending = true;
+  portEXIT_CRITICAL(&s_mux);
+}
+
+// ===== Table =====
+static Entry* slotFor(uint16_t orderId) {
+  Entry* free = nullptr;
+  for (Entry& e : s_tab) {
+    if ((e.used || e.dirty) && e.o.order_id == orderId) return &e;
+  }
+  for (Entry& e : s_tab) {
+    if (!e.used && !e.dirty) { free = &e; break; }
+  }
+  return free;
+}
+
+static void fill(Entry& e, uint16_t orderId, uint8_t index, uint8_t houseId, uint8_t mask,
+                 uint16_t remainS, const char* text, size_t textLen) {
+  e.o.order_id   = orderId;
+  e.o.index      = index;
+  e.o.house_id   = houseId;
+  e.o.mask       = mask;
+  e.o.timed      = remainS != PZ_ORDER_UNTIMED;
+  e.o.deadlineMs = millis() + (e.o.timed ? (uint32_t)remainS * 1000u : 0);
+  if (textLen >= sizeof(e.o.text)) textLen = sizeof(e.o.text) - 1;
+  memset(e.o.text, 0, sizeof(e.o.text));
+  if (textLen) memcpy(e.o.text, text, textLen);
+  e.used = 1;
+}
+
+// ===== Owner: ORDER_DELTA builder =====
+static size_t putRecord(uint8_t* out, const Entry& e) {
+  PzOrderDeltaRec r{};
+  r.order_id = e.o.order_id;
+  if (!e.used) {
+    r.op = ORDER_OP_REMOVE;
+    memcpy(out, &r, sizeof(r));
+    return sizeof(r);
+  }
+  r.op       = ORDER_OP_UPSERT;
+  r.index    = e.o.index;
+  r.house_id = e.o.house_id;
+  r.mask     = e.o.mask;
+  r.remain_s = e.o.timed ? remainS(e.o) : PZ_ORDER_UNTIMED;
+  r.text_len = (uint8_t)strnlen(e.o.text, sizeof(e.o.text));
+  memcpy(out, &r, sizeof(r));
+  memcpy(out + sizeof(r), e.o.text, r.text_len);
+  return sizeof(r) + r.text_len;
+}
+
+// full: every live order (snapshot); otherwise only dirty entries.
+static bool sendDelta(bool full, uint16_t gen, uint16_t baseGen, const uint8_t* dest) {
+  static uint8_t buf[DELTA_MAX];
+  PzOrderDeltaHeader h{};
+  h.gen      = gen;
+  h.base_gen = baseGen;
+  h.flags    = full ? PZ_ORDER_DELTA_FULL : 0;
+
+  size_t n = sizeof(h);
+  for (const Entry& e : s_tab) {
+    if (full ? !e.used : !e.dirty) continue;
+    n += putRecord(buf + n, e);
+    h.count++;
+  }
+  memcpy(buf, &h, sizeof(h));
+  s_lastTxMs = millis();
+  return PizzaNow::sendMsg(ORDER_DELTA, buf, (uint16_t)n, dest);
+}
+
+static void ownerLoop() {
+  bool dirty = false;
+  for (const Entry& e : s_tab) if (e.dirty) { dirty = true; break; }
+
+  // The generation moves and dirty marks clear only once the delta is out
+  // (the fragment queue may be full); otherwise the next loop() retries.
+  const uint16_t next = (uint16_t)(s_gen + 1);
+  if (s_fullPending) {
+    if (sendDelta(true, next, next, nullptr)) {
+      s_gen = next;
+      for (Entry& e : s_tab) e.dirty = 0;
+      s_fullPending = false;
+    }
+  } else if (dirty) {
+    if (sendDelta(false, next, s_gen, nullptr)) {
+      s_gen = next;
+      for (Entry& e : s_tab) e.dirty = 0;
+    }
+  } else if ((uint32_t)(millis() - s_lastTxMs) >= PZ_ORDERS_HEARTBEAT_MS) {
+    sendDelta(false, s_gen, s_gen, nullptr);   // no records: "still at s_gen"
+  }
+
+  uint8_t mac[6];
+  portENTER_CRITICAL(&s_mux);
+  const bool snap = s_snapPending;
+  memcpy(mac, s_snapMac, 6);
+  s_snapPending = false;
+  portEXIT_CRITICAL(&s_mux);
+  if (snap && !sendDelta(true, s_gen, s_gen, mac)) noteSnapReq(mac);   // retry next loop()
+}
+
+// ===== Station: ORDER_DELTA apply =====
+// Applies `count` records; false if the payload is malformed or the table is full.
+static bool applyRecords(const uint8_t* p, uint16_t len, uint8_t count) {
+  uint16_t off = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    PzOrderDeltaRec r;
+    if (off + sizeof(r) > len) return false;
+    memcpy(&r, p + off, sizeof(r));
+    off += sizeof(r);
+
+    if (r.op == ORDER_OP_REMOVE) {
+      for (Entry& e : s_tab) {
+        if (e.used && e.o.order_id == r.order_id) e.used = 0;
+      }
+      continue;
+    }
+    if (off + r.text_len > len) return false;
+    Entry* e = slotFor(r.order_id);
+    if (!e) return false;
+    fill(*e, r.order_id, r.index, r.house_id, r.mask, r.remain_s,
+         (const char*)p + off, r.text_len);
+    off += r.text_len;
+  }
+  return true;
+}
+
+static void stationDelta(const uint8_t* p, uint16_t len, const uint8_t mac[6]) {
+  PzOrderDeltaHeader h;
+  if (len < sizeof(h)) return;
+  memcpy(&h, p, sizeof(h));
+  p += sizeof(h); len -= sizeof(h);
+
+  memcpy(s_ownerMac, mac, 6);
+  s_haveOwner = true;
+
+  bool changed = false;
+  if (h.flags & PZ_ORDER_DELTA_FULL) {
+    memset(s_tab, 0, sizeof(s_tab));
+    s_synced   = applyRecords(p, len, h.count);
+    s_needSnap = !s_synced;
+    s_gen      = h.gen;
+    changed    = true;
+  } else if (s_synced && h.base_gen == s_gen) {
+    if (h.gen == s_gen) return;                // heartbeat, nothing new
+    if (!applyRecords(p, len, h.count)) { s_synced = false; s_needSnap = true; }
+    s_gen   = h.gen;
+    changed = true;
+  } else if (s_synced && h.gen == s_gen) {
+    return;                                    // repeat of a delta we applied
+  } else {
+    s_synced   = false;
+    s_needSnap = true;                         // missed a generation
+  }
+
+  if (changed && s_onChange) s_onChange();
+}
+
+static void stationLoop() {
+  RxDelta d;
+  while (popDelta(d)) stationDelta(d.data, d.len, d.mac);
+
+  if (!s_needSnap) return;
+  const uint32_t now = millis();
+  if ((uint32_t)(now - s_lastReqMs) < PZ_ORDERS_SNAP_RETRY_MS) return;
+  s_lastReqMs = now;
+
+  PzOrderSnapReqPayload req{ s_gen };
+  PizzaNow::sendMsg(ORDER_SNAP_REQ, &req, sizeof(req), s_haveOwner ? s_ownerMac : nullptr);
+}
+
+// ===== API =====
+void begin(bool owner) {
+  memset(s_tab, 0, sizeof(s_tab));
+  s_owner        = owner;
+  s_gen          = owner ? (uint16_t)esp_random() : 0;
+  s_fullPending  = owner;                      // announce the (empty) table right away
+  portENTER_CRITICAL(&s_mux);
+  s_snapPending  = false;
+  s_rxHead       = 0;
+  s_rxCount      = 0;
+  portEXIT_CRITICAL(&s_mux);
+  s_synced       = false;
+  s_needSnap     = !owner;
+  s_haveOwner    = false;
+  s_lastReqMs    = millis() - PZ_ORDERS_SNAP_RETRY_MS;
+}
+
+void loop() {
+  if (s_owner) ownerLoop();
+  else         stationLoop();
+}
+
+bool handle(const MsgHeader& hdr, const uint8_t* payload, uint16_t len, const uint8_t mac[6]) {
+  if (hdr.type == ORDER_DELTA) {
+    if (!s_owner) queueDelta(payload, len, mac);
+    return true;
+  }
+  if (hdr.type == ORDER_SNAP_REQ) {
+    if (s_owner) noteSnapReq(mac);
+    return true;
+  }
+  return false;
+}
+
+void onChange(ChangeHandler cb) { s_onChange = cb; }
+
+bool set(uint16_t orderId, uint8_t index, uint8_t houseId, uint8_t mask,
+         uint16_t remainS, const char* text) {
+  if (!s_owner) return false;
+  Entry* e = slotFor(orderId);
+  if (!e) return false;
+  if (!remainS)                            remainS = PZ_ORDER_UNTIMED;
+  else if (remainS == PZ_ORDER_UNTIMED)    remainS--;
+  fill(*e, orderId, index, houseId, mask, remainS, text ? text : "", text ? strlen(text) : 0);
+  e->dirty = 1;
+  return true;
+}
+
+bool remove(uint16_t orderId) {
+  if (!s_owner) return false;
+  for (Entry& e : s_tab) {
+    if (e.used && e.o.order_id == orderId) { e.used = 0; e.dirty = 1; return true; }
+  }
+  return false;
+}
+
+void clear() {
+  if (!s_owner) return;
+  memset(s_tab, 0, sizeof(s_tab));
+  s_fullPending = true;
+}
+
+uint16_t generation() { return s_gen; }
+bool     synced()     { return s_owner || s_synced; }
+
+uint8_t count() {
+  uint8_t n = 0;
+  for (const Entry& e : s_tab) if (e.used) n++;
+  return n;
+}
+
+const Order* at(uint8_t i) {
+  for (const Entry& e : s_tab) {
+    if (e.used && i-- == 0) return &e.o;
+  }
+  return nullptr;
+}
+
+const Order* find(uint16_t orderId) {
+  for (const Entry& e : s_tab) {
+    if (e.used && e.o.order_id == orderId) return &e.o;
+  }
+  return nullptr;
+}
+
+uint16_t remainS(const Order& o) {
+  if (!o.timed) return 0;
+  const int32_t left = (int32_t)(o.deadlineMs - millis());
+  if (left <= 0) return 0;
+  return (uint16_t)((left + 999) / 1000);
+}
+
+} // namespace PizzaOrders
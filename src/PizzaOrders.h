@@ -0,0 +1,55 @@
+// File: PizzaShared/include/PizzaOrders.h
+#pragma once
+#include <Arduino.h>
+#include <functional>
+#include "PizzaProtocol.h"
+
+// Versioned order table shared by Central and the order stations.
+//
+// The owner (Central) edits the table with set()/remove()/clear(); loop()
+// broadcasts everything that changed since the last call as one ORDER_DELTA
+// and bumps the generation. Stations apply a delta only on top of the
+// generation it was built from; after a gap they send ORDER_SNAP_REQ and the
+// owner answers with a full table. When idle the owner repeats its generation
+// every PZ_ORDERS_HEARTBEAT_MS so a station that missed the last delta notices.
+//
+// Timers travel as "seconds left" and become a local deadline on receipt, so
+// they count down on each station without being resent every tick.
+namespace PizzaOrders {
+  struct Order {
+    uint16_t order_id;
+    uint8_t  index;        // display slot 0..PZ_ORDERS_MAX-1
+    uint8_t  house_id;
+    uint8_t  mask;         // toppings bitmask
+    bool     timed;
+    uint32_t deadlineMs;   // local millis() deadline (valid if timed)
+    char     text[PZ_ORDER_TEXT_MAX];
+  };
+
+  typedef std::function<void()> ChangeHandler;
+
+  // owner=true on Central, false on stations. Resets the table.
+  void begin(bool owner);
+  void loop();
+
+  // Feed every received message; returns true if it was an order-sync message.
+  // Safe from receive context: it only queues. Deltas are applied, and the
+  // ChangeHandler runs, from loop(), so at()/find() results only change there.
+  bool handle(const MsgHeader& hdr, const uint8_t* payload, uint16_t len, const uint8_t mac[6]);
+  void onChange(ChangeHandler cb);
+
+  // ----- Owner -----
+  // Adds or replaces order `orderId`; remainS == 0 means untimed.
+  bool set(uint16_t orderId, uint8_t index, uint8_t houseId, uint8_t mask,
+           uint16_t remainS, const char* text);
+  bool remove(uint16_t orderId);
+  void clear();
+
+  // ----- Both -----
+  uint16_t generation();
+  bool     synced();                       // station: holds a complete table
+  uint8_t  count();
+  const Order* at(uint8_t i);              // i-th live order, nullptr past count()
+  const Order* find(uint16_t orderId);
+  uint16_t remainS(const Order& o);        // seconds left now, 0 if untimed/expired
+}
@@ -3,12 +3,20 @@
 #include "PizzaNow.h"
 #include "PizzaUtils.h"
 #include "PizzaNetCfg.h"
+#include "PizzaOtaManifest.h"
+#include "PizzaOtaImage.h"
 #include "BuildConfig.h"
 
 #include <WiFi.h>
 #include <HTTPClient.h>
-#include <Update.h>
+#include <Preferences.h>
 #include <esp_wifi.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
 
 #ifndef OTA_WIFI_CONNECT_MS
   #define OTA_WIFI_CONNECT_MS   45000
@@ -22,8 +30,20 @@
 
 namespace PizzaOta {
 
-static ProgressCB s_cb = nullptr;
+static ProgressCB     s_cb     = nullptr;
+static RateCB         s_rateCb = nullptr;
 void setProgressCallback(ProgressCB cb){ s_cb = cb; }
+void setRateCallback(RateCB cb){ s_rateCb = cb; }
+
+// True while a STA session runs next to a live ESP-NOW (OTA_KEEP_ESPNOW).
+static bool s_keepNow = false;
+
+// delay() that keeps PizzaNow serviced (RX, ACKs, resends) in keep mode.
+static void otaDelay(uint32_t ms) {
+  if (!s_keepNow) { delay(ms); return; }
+  uint32_t t0 = millis();
+  do { PizzaNow::loop(); delay(5); } while (millis() - t0 < ms);
+}
 
 static const char* wlName(wl_status_t s){
   switch (s){
@@ -41,17 +61,34 @@ static const char* wlName(wl_status_t s){
 static void wifiResetSta() {
   WiFi.persistent(false);
   WiFi.mode(WIFI_STA);
-  WiFi.disconnect(true, true);  // drop + clear creds
-  esp_wifi_stop();
-  delay(50);
-  esp_wifi_start();
+  if (s_keepNow) {
+    WiFi.disconnect(false, true);  // drop + clear creds, radio (and ESP-NOW) stays up
+    otaDelay(50);
+  } else {
+    WiFi.disconnect(true, true);  // drop + clear creds
+    esp_wifi_stop();
+    delay(50);
+    esp_wifi_start();
+  }
   esp_wifi_set_ps(WIFI_PS_NONE);
 }
 
+// Ends the STA session; in keep mode ESP-NOW returns to its own channel.
+static void wifiDone() {
+  WiFi.disconnect(!s_keepNow, true);
+  if (s_keepNow) {
+    PizzaNow::endStaWindow();
+    s_keepNow = false;
+  }
+}
+
 // NOTE: free function, not a class member
 static bool wifiConnect(uint32_t /*timeoutMs_unused*/) {
   NetCfg::Value net{}; NetCfg::load(net);
 
+  s_keepNow = OTA_KEEP_ESPNOW && PizzaNow::running();
+  if (s_keepNow) PizzaNow::beginStaWindow();
+
   for (int attempt = 1; attempt <= OTA_WIFI_RETRIES; ++attempt) {
     wifiResetSta();
     PZ_LOGI("WiFi: attempt %d/%d begin ssid=\"%s\"", attempt, OTA_WIFI_RETRIES, net.ssid);
@@ -65,34 +102,328 @@ static bool wifiConnect(uint32_t /*timeoutMs_unused*/) {
       if (st == WL_CONNECTED) {
         PZ_LOGI("WiFi: IP %s ch=%d RSSI=%d",
           WiFi.localIP().toString().c_str(), WiFi.channel(), WiFi.RSSI());
+        if (s_keepNow) PizzaNow::adoptRadioChannel();   // warns if Central is elsewhere
         return true;
       }
       if (millis() - t0 > OTA_WIFI_CONNECT_MS) break;
-      delay(100);
+      otaDelay(100);
     }
 
     PZ_LOGI("WiFi: attempt %d timeout (%s)", attempt, wlName(WiFi.status()));
-    WiFi.disconnect(true, true);
-    if (attempt < OTA_WIFI_RETRIES) delay(OTA_RETRY_BACKOFF_MS);
+    WiFi.disconnect(!s_keepNow, true);
+    if (attempt < OTA_WIFI_RETRIES) otaDelay(OTA_RETRY_BACKOFF_MS);
   }
   PZ_LOGE("WiFi: all attempts failed");
+  wifiDone();
   return false;
 }
 
-Result start(const char* url, const char* newVersion, uint32_t totalTimeoutMs) {
-  (void)newVersion;
-  PZ_LOGI("OTA start: %s", url);
+// ===== Flash sink =====
+// Writes the image straight into the next OTA partition at absolute offsets,
+// so a download can resume after a reboot (Update / esp_ota_begin would erase
+// the partition again). Sectors are erased just before the first write into
+// them; bytes rewritten after a resume are identical, so no re-erase is needed.
+struct PartSink {
+  const esp_partition_t* part = nullptr;
+  uint32_t erasedTo = 0;                 // [0, erasedTo) is erased or holds image data
 
-  PizzaNow::deinit();
-  delay(50);
+  bool begin(uint32_t resumeAt) {
+    part = esp_ota_get_next_update_partition(nullptr);
+    if (!part) return false;
+    erasedTo = (resumeAt + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+    return true;
+  }
 
-  uint32_t wifiBudget = totalTimeoutMs > 30000 ? totalTimeoutMs/3 : totalTimeoutMs/2;
-  if (!wifiConnect(wifiBudget)) {
-    WiFi.disconnect(true, true);
-    return WIFI_FAIL;
+  bool write(uint32_t off, const uint8_t* data, size_t n) {
+    if (!part || off + n > part->size) return false;
+    while (erasedTo < off + n) {
+      if (esp_partition_erase_range(part, erasedTo, SPI_FLASH_SEC_SIZE) != ESP_OK) return false;
+      erasedTo += SPI_FLASH_SEC_SIZE;
+    }
+    return esp_partition_write(part, off, data, n) == ESP_OK;
+  }
+
+  // Data from `off` on is discarded: its sectors are erased again before reuse.
+  void rewind(uint32_t off) {
+    off = off / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+    if (off < erasedTo) erasedTo = off;
   }
 
-  WiFiClient client; client.setTimeout(20000);
+  // Validates the image and makes it the boot partition.
+  bool finish() { return part && esp_ota_set_boot_partition(part) == ESP_OK; }
+};
+
+// ===== Resume state (NVS "pzota") =====
+// Keyed on URL + ETag and the target partition; offset is saved after each request.
+// Without an ETag or a manifest nothing proves the server still has the same
+// image, so such state is not resumed: a same-size replacement would land on
+// sectors PartSink treats as already erased.
+struct ResumeState {
+  uint32_t urlKey;
+  uint32_t etagKey;      // 0 = server sent no ETag
+  uint32_t partAddr;
+  uint32_t total;
+  uint32_t offset;
+};
+
+static const char* kOtaNs = "pzota";
+
+static uint32_t fnv1a(const char* s) {
+  uint32_t h = 2166136261u;
+  while (s && *s) { h ^= (uint8_t)*s++; h *= 16777619u; }
+  return h;
+}
+
+static bool loadResume(ResumeState& rs) {
+  Preferences p;
+  if (!p.begin(kOtaNs, true)) return false;
+  bool ok = p.getBytesLength("rs") == sizeof(rs) && p.getBytes("rs", &rs, sizeof(rs)) == sizeof(rs);
+  p.end();
+  return ok;
+}
+
+static void saveResume(const ResumeState& rs) {
+  Preferences p;
+  if (!p.begin(kOtaNs, false)) return;
+  p.putBytes("rs", &rs, sizeof(rs));
+  p.end();
+}
+
+static void clearResume() {
+  Preferences p;
+  if (!p.begin(kOtaNs, false)) return;
+  p.remove("rs");
+  p.end();
+}
+
+// ===== Manifest =====
+static OtaManifest::Manifest s_man;
+static bool     s_haveMan = false;
+static uint32_t s_shown   = 0;       // highest offset reported to s_cb
+static uint32_t s_rateFrom = 0;      // offset / time this session started at
+static uint32_t s_rateT0   = 0;
+
+static void progress(uint32_t done, uint32_t total) {
+  if (done <= s_shown && done) return;
+  s_shown = done;
+  if (s_cb) s_cb(done, total);
+  if (s_rateCb) {
+    const uint32_t ms = millis() - s_rateT0;
+    s_rateCb(done, total, ms ? (uint32_t)((uint64_t)(done - s_rateFrom) * 1000u / ms) : 0);
+  }
+}
+
+enum ManifestResult : uint8_t { MAN_OK, MAN_NONE, MAN_BAD, MAN_NET };
+
+static ManifestResult fetchManifest(const char* url) {
+  char murl[320];
+  if ((size_t)snprintf(murl, sizeof(murl), "%s%s", url, OTA_MANIFEST_SUFFIX) >= sizeof(murl)) return MAN_NONE;
+
+  WiFiClient client;
+  HTTPClient http;
+  http.setConnectTimeout(OTA_HTTP_CONNECT_MS);
+  http.setTimeout(OTA_HTTP_TOTAL_MS);
+  http.setFollowRedirects(HTTPC_STRICT_FOLLOW_REDIRECTS);
+  if (!http.begin(client, murl)) return MAN_NET;
+  int code = http.GET();
+  if (code == HTTP_CODE_NOT_FOUND) { http.end(); return MAN_NONE; }
+  if (code != HTTP_CODE_OK)        { http.end(); return MAN_NET; }
+  String text = http.getString();
+  http.end();
+
+  if (!OtaManifest::parse(text.c_str(), text.length(), s_man)) {
+    PZ_LOGE("OTA: manifest rejected");
+    return MAN_BAD;
+  }
+  PZ_LOGI("OTA: manifest v%s %u bytes, %u blocks%s", s_man.version, (unsigned)s_man.size,
+          (unsigned)s_man.blocks, s_man.sig ? ", signed" : "");
+  return MAN_OK;
+}
+
+// ===== Encoded images (PizzaOtaImage.h) =====
+static bool imgWrite(void* ctx, uint32_t off, const uint8_t* data, size_t len) {
+  return ((PartSink*)ctx)->write(off, data, len);
+}
+
+static bool imgReadBase(void*, uint32_t off, uint8_t* data, size_t len) {
+  const esp_partition_t* run = esp_ota_get_running_partition();
+  return run && esp_partition_read(run, off, data, len) == ESP_OK;
+}
+
+// A delta only applies to the exact image it was diffed against.
+static bool imgCheckBase(void*, const PzImgHeader& h) {
+  const esp_partition_t* run = esp_ota_get_running_partition();
+  if (!run || h.base_size > run->size) return false;
+  mbedtls_sha256_context c;
+  mbedtls_sha256_init(&c);
+  mbedtls_sha256_starts(&c, 0);
+  uint8_t buf[1024];
+  bool ok = true;
+  for (uint32_t off = 0; ok && off < h.base_size; off += sizeof(buf)) {
+    const uint32_t n = h.base_size - off < sizeof(buf) ? h.base_size - off : sizeof(buf);
+    ok = esp_partition_read(run, off, buf, n) == ESP_OK;
+    if (ok) mbedtls_sha256_update(&c, buf, n);
+  }
+  uint8_t digest[32];
+  mbedtls_sha256_finish(&c, digest);
+  mbedtls_sha256_free(&c);
+  ok = ok && memcmp(digest, h.base_sha, sizeof(digest)) == 0;
+  if (!ok) PZ_LOGE("OTA: delta was built against another firmware");
+  return ok;
+}
+
+// ===== Flash pipeline =====
+// The loop task fills OTA_PIPE_BUFS buffers from the socket while a writer
+// task erases/writes flash (and hashes blocks), so network and flash time
+// overlap. The sink and hasher belong to the writer until drain() returns.
+class FlashPipe {
+  static_assert(OTA_PIPE_BUFS < 0xFF && OTA_PIPE_BUF_BYTES <= 0xFFFF, "OTA pipe too large");
+public:
+  ~FlashPipe() { end(); }
+
+  bool begin(PartSink* sink) {
+    _sink = sink;
+    for (uint8_t i = 0; i < OTA_PIPE_BUFS; i++) {
+      // PSRAM when present; flash writes bounce through an internal buffer.
+      _slot[i].data = (uint8_t*)heap_caps_malloc(OTA_PIPE_BUF_BYTES, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+      if (!_slot[i].data) _slot[i].data = (uint8_t*)malloc(OTA_PIPE_BUF_BYTES);
+      if (!_slot[i].data) { PZ_LOGE("OTA: pipe buffer alloc failed"); return false; }
+    }
+    _free = xQueueCreate(OTA_PIPE_BUFS, sizeof(uint8_t));
+    _full = xQueueCreate(OTA_PIPE_BUFS + 1, sizeof(uint8_t));
+    if (!_free || !_full) return false;
+    for (uint8_t i = 0; i < OTA_PIPE_BUFS; i++) xQueueSend(_free, &i, 0);
+    _caller = xTaskGetCurrentTaskHandle();
+    xTaskCreatePinnedToCore(writerTask, "pz_ota_wr", WRITER_STACK_BYTES, this,
+                            WRITER_PRIO, &_task, tskNO_AFFINITY);
+    return _task != nullptr;
+  }
+
+  void end() {
+    if (_task) {
+      uint8_t stop = STOP;
+      xQueueSend(_full, &stop, portMAX_DELAY);
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);   // writer exited
+      _task = nullptr;
+    }
+    if (_free) { vQueueDelete(_free); _free = nullptr; }
+    if (_full) { vQueueDelete(_full); _full = nullptr; }
+    for (Slot& s : _slot) { free(s.data); s.data = nullptr; }
+  }
+
+  // Only while drained: next input position, fresh block hash, errors cleared.
+  // An encoded image continuing at flushed() keeps its decoder and hash state.
+  void reset(uint32_t at) {
+    _err = ERR_NONE;
+    if (_dec.active() && at && at == _flushed) return;
+    _dec.end();
+    _flushed = _verified = at;
+    if (s_haveMan) _hasher.begin();
+  }
+
+  // Free buffer index, or -1 after waitMs.
+  int acquire(uint32_t waitMs) {
+    uint8_t i;
+    return xQueueReceive(_free, &i, pdMS_TO_TICKS(waitMs)) == pdTRUE ? i : -1;
+  }
+  uint8_t* buf(int i) { return _slot[i].data; }
+  void release(int i) { uint8_t b = (uint8_t)i; xQueueSend(_free, &b, portMAX_DELAY); }
+
+  // Hands `len` bytes of buffer i (image offset `off`) to the writer.
+  // blockEnd: last bytes of a manifest block; the block hash is checked after.
+  void push(int i, uint32_t off, uint16_t len, bool blockEnd) {
+    _slot[i].off = off; _slot[i].len = len; _slot[i].blockEnd = blockEnd;
+    uint8_t b = (uint8_t)i;
+    xQueueSend(_full, &b, portMAX_DELAY);
+  }
+
+  // Waits until every buffer is back; keeps ESP-NOW serviced meanwhile.
+  void drain() {
+    int held[OTA_PIPE_BUFS];
+    for (uint8_t n = 0; n < OTA_PIPE_BUFS; ) {
+      int i = acquire(5);
+      if (i >= 0) held[n++] = i;
+      else if (s_keepNow) PizzaNow::loop();
+    }
+    for (int i : held) release(i);
+  }
+
+  enum Error : uint8_t { ERR_NONE, ERR_WRITE, ERR_HASH, ERR_DECODE };
+  Error    error()    const { return _err; }
+  uint32_t flushed()  const { return _flushed; }   // input consumed (written or decoded)
+  uint32_t verified() const { return _verified; }  // == flushed() without a manifest
+  bool     encoded()  const { return _dec.active(); }
+  bool     complete() const { return !_dec.active() || _dec.done(); }
+  uint32_t imageSize() const { return _dec.active() ? _dec.written() : _flushed; }
+
+private:
+  static constexpr uint8_t     STOP               = 0xFF;
+  static constexpr uint32_t    WRITER_STACK_BYTES = OTA_WRITER_STACK_BYTES;
+  static constexpr UBaseType_t WRITER_PRIO        = 1;   // same as the Arduino loop task
+
+  struct Slot { uint8_t* data = nullptr; uint32_t off; uint16_t len; bool blockEnd; };
+
+  static void writerTask(void* arg) {
+    FlashPipe* p = (FlashPipe*)arg;
+    uint8_t i;
+    while (xQueueReceive(p->_full, &i, portMAX_DELAY) == pdTRUE && i != STOP) {
+      p->consume(p->_slot[i]);
+      xQueueSend(p->_free, &i, portMAX_DELAY);
+    }
+    xTaskNotifyGive(p->_caller);
+    vTaskDelete(nullptr);
+  }
+
+  void consume(const Slot& s) {
+    if (_err != ERR_NONE) return;                // drop the rest of a failed request
+    if (s.off == 0 && OtaImage::isEncoded(s.data, s.len)) {
+      const OtaImage::Io io{ _sink, imgWrite, imgReadBase, imgCheckBase };
+      if (!_dec.begin(io)) { PZ_LOGE("OTA: decoder alloc failed"); _err = ERR_DECODE; return; }
+    }
+    if (_dec.active()) {
+      if (!_dec.feed(s.data, s.len)) { _err = ERR_DECODE; return; }
+    } else if (!_sink->write(s.off, s.data, s.len)) {
+      _err = ERR_WRITE; return;
+    }
+    _flushed = s.off + s.len;
+    if (!s_haveMan) { _verified = _flushed; return; }
+    _hasher.update(s.data, s.len);
+    if (!s.blockEnd) return;
+    if (!_hasher.finish(s_man, (uint16_t)((_flushed - 1) / s_man.block))) { _err = ERR_HASH; return; }
+    _verified = _flushed;
+  }
+
+  PartSink*                 _sink = nullptr;
+  Slot                      _slot[OTA_PIPE_BUFS];
+  QueueHandle_t             _free = nullptr;
+  QueueHandle_t             _full = nullptr;
+  TaskHandle_t              _task = nullptr;
+  TaskHandle_t              _caller = nullptr;
+  OtaManifest::BlockHasher  _hasher;
+  OtaImage::Decoder         _dec;
+  volatile uint32_t         _flushed  = 0;
+  volatile uint32_t         _verified = 0;
+  volatile Error            _err      = ERR_NONE;
+};
+
+// ===== One Range request =====
+enum ChunkResult : uint8_t { CHUNK_OK, CHUNK_RETRY, CHUNK_CHANGED, CHUNK_WRITE_FAIL, CHUNK_CORRUPT,
+                             CHUNK_DECODE_FAIL };
+
+// True once a 200 without Content-Length was seen: the image is streamed to
+// EOF and its length is only known at the end, so nothing is saved for resume.
+static bool s_unsized = false;
+
+// Fetches [rs.offset, rs.offset + chunk) into the sink and advances rs.offset
+// by whatever arrived. A server that ignores Range (200) streams the whole
+// file; bytes before rs.offset are then skipped. Without Content-Length (and
+// no manifest size) the body is read to EOF, which then sets rs.total.
+// With a manifest each block is hashed as it is written and rs.offset only
+// moves past verified blocks; a bad block is rewound and CHUNK_CORRUPT returned.
+// An encoded image cannot be rewound: it continues from the last byte consumed.
+static ChunkResult fetchChunk(const char* url, ResumeState& rs, PartSink& sink, FlashPipe& pipe,
+                              uint32_t chunk) {
+  WiFiClient client; client.setTimeout(OTA_STALL_MS);
 
   HTTPClient http;
   http.setConnectTimeout(OTA_HTTP_CONNECT_MS);
@@ -103,86 +434,268 @@ Result start(const char* url, const char* newVersion, uint32_t totalTimeoutMs) {
 
   if (!http.begin(client, url)) {
     PZ_LOGE("OTA: HTTP begin failed");
-    http.end(); WiFi.disconnect(true, true);
-    return HTTP_FAIL;
+    return CHUNK_RETRY;
   }
+  const char* keys[] = { "Content-Range", "ETag" };
+  http.collectHeaders(keys, 2);
+
+  uint32_t last = rs.offset + chunk - 1;
+  if (rs.total && last >= rs.total) last = rs.total - 1;
+  char range[40];
+  snprintf(range, sizeof(range), "bytes=%u-%u", (unsigned)rs.offset, (unsigned)last);
+  http.addHeader("Range", range);
 
   int code = http.GET();
-  PZ_LOGI("OTA: HTTP GET -> %d", code);
-  if (code != HTTP_CODE_OK) {
-    http.end(); WiFi.disconnect(true, true);
-    return HTTP_FAIL;
+  uint32_t skip = 0, want = 0, total = 0;
+  if (code == HTTP_CODE_PARTIAL_CONTENT) {
+    unsigned a = 0, b = 0, t = 0;
+    String cr = http.header("Content-Range");
+    if (sscanf(cr.c_str(), "bytes %u-%u/%u", &a, &b, &t) != 3 || a != rs.offset || b < a) {
+      PZ_LOGE("OTA: bad Content-Range \"%s\" for %s", cr.c_str(), range);
+      http.end();
+      return CHUNK_RETRY;
+    }
+    total = t;
+    want  = b - a + 1;
+  } else if (code == HTTP_CODE_OK && http.getSize() > 0) {
+    total = (uint32_t)http.getSize();
+    skip  = rs.offset;
+    want  = total - rs.offset;
+  } else if (code == HTTP_CODE_OK) {
+    // HTTP/1.0 reply without Content-Length: the body ends when the server closes.
+    total = rs.total;                  // known only from a manifest
+    skip  = rs.offset;
+    want  = total ? total - rs.offset : UINT32_MAX;
+    if (!total && !s_unsized) {
+      PZ_LOGI("OTA: no Content-Length; streaming to EOF (not resumable after reboot)");
+      s_unsized = true;
+    }
+  } else {
+    PZ_LOGE("OTA: GET %s -> %d", range, code);
+    http.end();
+    return CHUNK_RETRY;
+  }
+
+  const uint32_t etagKey = fnv1a(http.header("ETag").c_str());
+  if ((rs.total && total && total != rs.total) || (rs.etagKey && etagKey != rs.etagKey)) {
+    PZ_LOGI("OTA: image changed on server, restarting from 0");
+    http.end();
+    return CHUNK_CHANGED;
   }
+  rs.total   = total;
+  rs.etagKey = etagKey;
 
-  int len = http.getSize();
-  PZ_LOGI("OTA: content length = %d", len);
-  size_t totalLen = (len > 0) ? (size_t)len : 0;
+  WiFiClient& stream = http.getStream();
+  uint32_t lastData = millis();
+  uint32_t pos  = rs.offset;         // next image offset to read
+  int      cur  = -1;                // buffer being filled
+  uint32_t fill = 0;
+  bool stalled  = false;
+  pipe.reset(rs.offset);
 
-  if (totalLen == 0) {
-    if (!Update.begin(UPDATE_SIZE_UNKNOWN)) {
-      PZ_LOGE("OTA: Update.begin(unknown) failed");
-      http.end(); WiFi.disconnect(true, true);
-      return UPDATE_FAIL;
+  while (want && http.connected() && pipe.error() == FlashPipe::ERR_NONE) {
+    if (cur < 0 && (cur = pipe.acquire(5)) < 0) {   // writer busy: flash is the bottleneck
+      if (s_keepNow) PizzaNow::loop();
+      continue;
     }
-  } else {
-    if (!Update.begin(totalLen)) {
-      PZ_LOGE("OTA: Update.begin(%u) failed", (unsigned)totalLen);
-      http.end(); WiFi.disconnect(true, true);
-      return UPDATE_FAIL;
+    size_t ask = OTA_PIPE_BUF_BYTES - fill;
+    if (skip) { if (skip < ask) ask = skip; }
+    else {
+      if (want < ask) ask = want;
+      if (s_haveMan && s_man.block - pos % s_man.block < ask) ask = s_man.block - pos % s_man.block;
+    }
+    size_t n = stream.readBytes(pipe.buf(cur) + fill, ask);
+    if (s_keepNow) PizzaNow::loop();
+    if (!n) {
+      if (millis() - lastData > OTA_STALL_MS) { stalled = true; break; }
+      continue;
+    }
+    lastData = millis();
+    if (skip) { skip -= n; continue; }               // buffer reused as scratch
+
+    fill += n;
+    pos  += n;
+    want -= n;
+    const bool blockEnd = s_haveMan && (pos % s_man.block == 0 || pos == rs.total);
+    if (fill == OTA_PIPE_BUF_BYTES || blockEnd || !want) {
+      pipe.push(cur, pos - fill, (uint16_t)fill, blockEnd);
+      cur = -1; fill = 0;
+      progress(pipe.flushed(), rs.total);
     }
   }
+  http.end();
+  if (!total && !stalled && want && pipe.error() == FlashPipe::ERR_NONE && !skip) {
+    rs.total = pos;                    // clean EOF of an unsized body
+    want = 0;
+  }
+  // Partial buffer: written, not verified. A tiny first piece is dropped so
+  // the encoded-image check always sees the whole magic.
+  if (cur >= 0 && fill && (pos > fill || fill >= sizeof(PzImgHeader)))
+    pipe.push(cur, pos - fill, (uint16_t)fill, false);
+  else if (cur >= 0)
+    pipe.release(cur);
+  pipe.drain();
+  progress(pipe.flushed(), rs.total);
 
-  if (s_cb) s_cb(0, totalLen); // show 0% (or unknown)
+  if (pipe.encoded()) {
+    if (pipe.error() == FlashPipe::ERR_HASH) PZ_LOGE("OTA: block hash mismatch in encoded image");
+    if (pipe.error() == FlashPipe::ERR_DECODE) PZ_LOGE("OTA: image decode failed after %u", (unsigned)pipe.flushed());
+    rs.offset = pipe.flushed();
+    switch (pipe.error()) {
+      case FlashPipe::ERR_NONE: return want ? CHUNK_RETRY : CHUNK_OK;
+      case FlashPipe::ERR_HASH: return CHUNK_CORRUPT;
+      default:                  return CHUNK_DECODE_FAIL;
+    }
+  }
+  switch (pipe.error()) {
+    case FlashPipe::ERR_DECODE:
+      return CHUNK_DECODE_FAIL;
+    case FlashPipe::ERR_WRITE:
+      PZ_LOGE("OTA: flash write failed after %u", (unsigned)pipe.flushed());
+      return CHUNK_WRITE_FAIL;
+    case FlashPipe::ERR_HASH:
+      PZ_LOGE("OTA: block %u hash mismatch", (unsigned)(pipe.verified() / s_man.block));
+      sink.rewind(rs.offset = pipe.verified());
+      return CHUNK_CORRUPT;
+    default: break;
+  }
+  rs.offset = pipe.verified();
+  if (pipe.flushed() != rs.offset) sink.rewind(rs.offset);   // unverified tail of a block
+  return want ? CHUNK_RETRY : CHUNK_OK;
+}
 
-  WiFiClient& stream = http.getStream();
-  uint8_t buf[2048];
-  size_t totalWritten = 0;
-  uint32_t lastProgress = millis();
-  uint32_t startAt = lastProgress;
-
-  while (http.connected() && (len > 0 || totalLen == 0)) {
-    size_t n = stream.readBytes(buf, sizeof(buf));
-    if (n > 0) {
-      if (Update.write(buf, n) != n) {
-        PZ_LOGE("OTA: Update.write failed at %u bytes", (unsigned)totalWritten);
-        Update.abort(); http.end(); WiFi.disconnect(true, true);
-        return UPDATE_FAIL;
-      }
-      totalWritten += n;
+Result start(const char* url, const char* newVersion, uint32_t totalTimeoutMs) {
+  PZ_LOGI("OTA start: %s", url);
 
-      // notify progress each chunk or ~200ms
-      if (s_cb && (millis() - lastProgress > 200)) {
-        s_cb(totalWritten, totalLen);
-        lastProgress = millis();
-      }
+  if (!OTA_KEEP_ESPNOW) {
+    PizzaNow::deinit();
+    delay(50);
+  }
 
-      if (len > 0) len -= n;
-    } else {
-      if (millis() - lastProgress > 1500) {
-        PZ_LOGI("OTA: waiting for data...");
-        lastProgress = millis();
-        if (s_cb) s_cb(totalWritten, totalLen);
-      }
-    }
+  uint32_t wifiBudget = totalTimeoutMs > 30000 ? totalTimeoutMs/3 : totalTimeoutMs/2;
+  if (!wifiConnect(wifiBudget)) {
+    return WIFI_FAIL;
+  }
+
+  ManifestResult mr = MAN_NET;
+  for (uint8_t i = 0; i <= OTA_CHUNK_RETRIES && mr == MAN_NET; i++) {
+    if (i) otaDelay(OTA_RETRY_BACKOFF_MS / 4 * i);
+    mr = fetchManifest(url);
+  }
+  s_haveMan = mr == MAN_OK;
+  bool need = OTA_REQUIRE_MANIFEST;
+#ifdef PZ_OTA_PUBKEY_PEM
+  need = true;
+#endif
+  if (mr == MAN_BAD || (need && !s_haveMan) ||
+      (s_haveMan && newVersion && *newVersion && strcmp(newVersion, s_man.version) != 0)) {
+    if (s_haveMan) PZ_LOGE("OTA: manifest is v%s, expected v%s", s_man.version, newVersion);
+    else           PZ_LOGE("OTA: no usable manifest");
+    wifiDone();
+    return VERIFY_FAIL;
+  }
+  const uint32_t chunk = s_haveMan ? s_man.block : OTA_CHUNK_BYTES;
+
+  PartSink sink;
+  ResumeState rs{};
+  const esp_partition_t* next = esp_ota_get_next_update_partition(nullptr);
+  if (!next) {
+    PZ_LOGE("OTA: no update partition");
+    wifiDone();
+    return UPDATE_FAIL;
+  }
+  if (!loadResume(rs) || rs.urlKey != fnv1a(url) || rs.partAddr != next->address ||
+      !rs.total || rs.offset >= rs.total || (s_haveMan && rs.total != s_man.size) ||
+      (!rs.etagKey && !s_haveMan)) {
+    rs = ResumeState{};
+    rs.urlKey   = fnv1a(url);
+    rs.partAddr = next->address;
+    rs.total    = s_haveMan ? s_man.size : 0;
+  } else {
+    if (s_haveMan) rs.offset -= rs.offset % s_man.block;  // state from an unverified run
+    PZ_LOGI("OTA: resuming at %u/%u", (unsigned)rs.offset, (unsigned)rs.total);
+  }
+  sink.begin(rs.offset);
+  FlashPipe pipe;
+  if (!pipe.begin(&sink)) {
+    wifiDone();
+    return UPDATE_FAIL;
+  }
+  s_shown    = 0;
+  s_unsized  = false;
+  s_rateFrom = rs.offset;
+  s_rateT0   = millis();
+  progress(rs.offset, rs.total);        // 0% / unknown, or where we left off
 
+  const uint32_t startAt = millis();
+  uint8_t fails = 0;
+  while (!rs.total || rs.offset < rs.total) {
     if (millis() - startAt > totalTimeoutMs) {
-      PZ_LOGE("OTA: overall timeout after %u bytes", (unsigned)totalWritten);
-      Update.abort(); http.end(); WiFi.disconnect(true, true);
+      PZ_LOGE("OTA: overall timeout at %u/%u bytes (resumable)", (unsigned)rs.offset, (unsigned)rs.total);
+      wifiDone();
       return TIMEOUT;
     }
+    if (WiFi.status() != WL_CONNECTED && !wifiConnect(wifiBudget)) {
+      return WIFI_FAIL;
+    }
+
+    const uint32_t before = rs.offset;
+    ChunkResult r = fetchChunk(url, rs, sink, pipe, chunk);
+    if (r == CHUNK_WRITE_FAIL || r == CHUNK_DECODE_FAIL) {
+      clearResume();
+      wifiDone();
+      return UPDATE_FAIL;
+    }
+    if (r == CHUNK_CORRUPT && pipe.encoded()) {
+      wifiDone();
+      return VERIFY_FAIL;
+    }
+    if (r == CHUNK_CHANGED && s_haveMan) {
+      PZ_LOGE("OTA: image no longer matches its manifest");
+      clearResume();
+      wifiDone();
+      return VERIFY_FAIL;
+    }
+    if (r == CHUNK_CHANGED) {
+      rs.offset = rs.total = rs.etagKey = 0;
+      sink.begin(0);
+      s_shown    = 0;                   // progress() only reports forward moves
+      s_rateFrom = 0;
+      s_rateT0   = millis();
+      progress(0, 0);
+    }
+    // Decoder state lives in RAM only: encoded images restart after a reboot.
+    if (!pipe.encoded() && !s_unsized && (rs.offset != before || r == CHUNK_CHANGED)) saveResume(rs);
+
+    if (r == CHUNK_OK || rs.offset != before) { fails = 0; continue; }
+    if (++fails > OTA_CHUNK_RETRIES) {
+      PZ_LOGE("OTA: giving up at %u/%u bytes (resumable)", (unsigned)rs.offset, (unsigned)rs.total);
+      wifiDone();
+      if (r == CHUNK_CORRUPT) return VERIFY_FAIL;
+      return rs.total ? HTTP_FAIL : SIZE_ZERO;
+    }
+    otaDelay(OTA_RETRY_BACKOFF_MS / 4 * fails);
   }
 
-  if (!Update.end(true)) {
-    PZ_LOGE("OTA: Update.end failed");
-    http.end(); WiFi.disconnect(true, true);
+  clearResume();
+  if (!pipe.complete()) {
+    PZ_LOGE("OTA: encoded image ended early");
+    wifiDone();
+    return UPDATE_FAIL;
+  }
+  if (pipe.encoded()) {
+    PZ_LOGI("OTA: %u bytes downloaded, %u bytes rebuilt", (unsigned)rs.total, (unsigned)pipe.imageSize());
+  }
+  if (!sink.finish()) {
+    PZ_LOGE("OTA: image rejected (set_boot_partition)");
+    wifiDone();
     return UPDATE_FAIL;
   }
-  
+
   // Force a final "done" notification so the panel can draw DONE
   if (s_cb) s_cb(1, 1);
 
-  http.end();
-  WiFi.disconnect(true, true);
+  wifiDone();
   PZ_LOGI("OTA: OK, rebooting");
   delay(OTA_DONE_HOLD_MS); // let visuals show 100%
   ESP.restart();
@@ -195,7 +708,7 @@ bool beginWifi(uint32_t timeoutMs){
 }
 
 void endWifi(){
-  WiFi.disconnect(true, true);
+  wifiDone();
 }
 
 } // namespace
@@ -2,18 +2,40 @@
 #include <Arduino.h>
 
 namespace PizzaOta {
-  enum Result : uint8_t { OK=0, WIFI_FAIL=1, HTTP_FAIL=2, SIZE_ZERO=3, UPDATE_FAIL=4, TIMEOUT=5 };
+  enum Result : uint8_t { OK=0, WIFI_FAIL=1, HTTP_FAIL=2, SIZE_ZERO=3, UPDATE_FAIL=4, TIMEOUT=5, VERIFY_FAIL=6 };
 
   // Progress callback: total==0 means unknown size. Called from loop context.
   typedef void (*ProgressCB)(size_t written, size_t total);
   void setProgressCallback(ProgressCB cb);
-  bool beginWifi(uint32_t timeoutMs);   // true when WL_CONNECTED
-  void endWifi();                       // clean Wi-Fi disconnect
+  // Same moments as ProgressCB, plus the average download rate of this start() call.
+  typedef void (*RateCB)(size_t written, size_t total, uint32_t bytesPerSec);
+  void setRateCallback(RateCB cb);
+  bool beginWifi(uint32_t timeoutMs);   // true when WL_CONNECTED (ESP-NOW kept, see start)
+  void endWifi();                       // clean Wi-Fi disconnect; ESP-NOW back to its channel
 
   // Performs full OTA pull (blocking in loop context):
-  // 1) PizzaNow::deinit()
+  // 1) OTA_KEEP_ESPNOW: ESP-NOW stays up and follows the AP channel, and
+  //    PizzaNow::loop() keeps running while waiting; otherwise PizzaNow::deinit().
+  //    Traffic with Central only keeps flowing if Central is on the AP channel
+  //    too (see PizzaNow::adoptRadioChannel); otherwise it resumes afterwards.
   // 2) Wi-Fi STA connect (WIFI_SSID/PASS)
-  // 3) HTTP GET .bin and Update (streams with progress callbacks)
+  // 3) Downloads the .bin in OTA_CHUNK_BYTES HTTP Range requests straight into
+  //    the next OTA partition (a writer task flashes OTA_PIPE_BUFS buffers
+  //    while the next ones are read from the socket); each failed request is retried up to
+  //    OTA_CHUNK_RETRIES times. The written offset is kept in NVS, so a call
+  //    interrupted by a timeout, Wi-Fi loss or reboot resumes where it stopped
+  //    (same URL and ETag, or a manifest; without either it starts over).
+  //    Progress never goes backwards unless the server image changed, which
+  //    restarts it from 0. Servers without Range support are handled by skipping.
+  //    A 200 without Content-Length is read to EOF; such a download restarts
+  //    after a reboot (nothing to check a resume against). The image header
+  //    check at the end still rejects a truncated body.
+  //    When "<url>" OTA_MANIFEST_SUFFIX exists (see PizzaOtaManifest.h) every
+  //    block is SHA-256 checked as it is written and the manifest version must
+  //    equal newVersion; a bad block is fetched again, then VERIFY_FAIL.
+  //    Compressed or delta images (PizzaOtaImage.h, built with
+  //    extras/tools/pz_img.py) are recognised by their header and decoded
+  //    while streaming; they resume within one call but not across reboots.
   // 4) On success, shows 100% via progress callback and reboots
   Result start(const char* absoluteUrl, const char* newVersion, uint32_t totalTimeoutMs = 60000);
 }
\ No newline at end of file
@@ -0,0 +1,180 @@
+// File: PizzaShared/src/PizzaOtaImage.cpp
+#include "PizzaOtaImage.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Inflate backend: the miniz tinfl in ESP32 ROM on device, zlib on the host
+// (extras/tools/pz_img_check.cpp). Both are fed raw deflate (no zlib header).
+#if defined(ARDUINO_ARCH_ESP32) && defined(__has_include)
+  #include <sdkconfig.h>
+  #if __has_include(<rom/miniz.h>)
+    #include <rom/miniz.h>
+    #define PZ_HAVE_ROM_TINFL 1
+  #elif defined(CONFIG_IDF_TARGET_ESP32S3) && __has_include(<esp32s3/rom/miniz.h>)
+    #include <esp32s3/rom/miniz.h>
+    #define PZ_HAVE_ROM_TINFL 1
+  #elif defined(CONFIG_IDF_TARGET_ESP32) && __has_include(<esp32/rom/miniz.h>)
+    #include <esp32/rom/miniz.h>
+    #define PZ_HAVE_ROM_TINFL 1
+  #endif
+#endif
+#ifndef PZ_HAVE_ROM_TINFL
+  #define PZ_HAVE_ROM_TINFL 0
+  #include <zlib.h>
+#endif
+
+namespace OtaImage {
+
+static const uint32_t WIN = 32768;       // deflate window; power of two for tinfl
+
+static uint32_t rdU32(const uint8_t* p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+bool isEncoded(const uint8_t* data, size_t len) {
+  return len >= sizeof(PZ_IMG_MAGIC) && memcmp(data, PZ_IMG_MAGIC, sizeof(PZ_IMG_MAGIC)) == 0;
+}
+
+bool Decoder::begin(const Io& io) {
+  end();
+  _io = io;
+  _hdrFill = 0; _failed = false; _done = false; _out = 0;
+  _winPos = 0; _op = 0; _argFill = 0; _haveArgs = false; _src = 0; _left = 0;
+
+  _win = (uint8_t*)malloc(WIN);
+#if PZ_HAVE_ROM_TINFL
+  _inf = malloc(sizeof(tinfl_decompressor));
+  if (_inf) tinfl_init((tinfl_decompressor*)_inf);
+#else
+  z_stream* z = (z_stream*)calloc(1, sizeof(z_stream));
+  if (z && inflateInit2(z, -15) != Z_OK) { free(z); z = nullptr; }
+  _inf = z;
+#endif
+  if (!_win || !_inf) { end(); return false; }
+  return true;
+}
+
+void Decoder::end() {
+#if !PZ_HAVE_ROM_TINFL
+  if (_inf) inflateEnd((z_stream*)_inf);
+#endif
+  free(_inf); _inf = nullptr;
+  free(_win); _win = nullptr;
+}
+
+bool Decoder::feed(const uint8_t* data, size_t len) {
+  if (_failed || !_win) return false;
+  if (_done) return true;                          // trailing bytes after END
+
+  if (_hdrFill < sizeof(_hdr)) {
+    size_t n = sizeof(_hdr) - _hdrFill;
+    if (n > len) n = len;
+    memcpy((uint8_t*)&_hdr + _hdrFill, data, n);
+    _hdrFill += n; data += n; len -= n;
+    if (_hdrFill < sizeof(_hdr)) return true;
+
+    const bool ok = isEncoded(_hdr.magic, sizeof(_hdr.magic)) &&
+                    (_hdr.kind == PZ_IMG_DEFLATE ||
+                     (_hdr.kind == PZ_IMG_DELTA && _io.checkBase && _io.checkBase(_io.ctx, _hdr)));
+    if (!ok) { _failed = true; return false; }
+  }
+  if (len && !inflate(data, len)) _failed = true;
+  return !_failed;
+}
+
+bool Decoder::inflate(const uint8_t* in, size_t len) {
+#if PZ_HAVE_ROM_TINFL
+  tinfl_decompressor* r = (tinfl_decompressor*)_inf;
+  for (;;) {
+    size_t inBytes = len, outBytes = WIN - _winPos;
+    tinfl_status st = tinfl_decompress(r, in, &inBytes, _win, _win + _winPos, &outBytes,
+                                       TINFL_FLAG_HAS_MORE_INPUT);
+    in += inBytes; len -= inBytes;
+    if (outBytes && !emit(_win + _winPos, outBytes)) return false;
+    _winPos = (_winPos + outBytes) & (WIN - 1);
+    if (st < TINFL_STATUS_DONE) return false;
+    if (st == TINFL_STATUS_DONE || _done) return true;
+    if (st == TINFL_STATUS_NEEDS_MORE_INPUT && (!len || (!inBytes && !outBytes))) return true;
+  }
+#else
+  z_stream* z = (z_stream*)_inf;
+  z->next_in  = (Bytef*)in;
+  z->avail_in = (uInt)len;
+  for (;;) {
+    z->next_out  = _win + _winPos;
+    z->avail_out = WIN - _winPos;
+    int rc = ::inflate(z, Z_NO_FLUSH);
+    const uint32_t got = (WIN - _winPos) - z->avail_out;
+    if (got && !emit(_win + _winPos, got)) return false;
+    _winPos = (_winPos + got) & (WIN - 1);
+    if (rc == Z_STREAM_END || _done) return true;
+    if (rc != Z_OK && rc != Z_BUF_ERROR) return false;
+    if (!z->avail_in && z->avail_out) return true;
+  }
+#endif
+}
+
+bool Decoder::emit(const uint8_t* data, size_t len) {
+  return _hdr.kind == PZ_IMG_DELTA ? ops(data, len) : out(data, len);
+}
+
+bool Decoder::out(const uint8_t* data, size_t len) {
+  if (_out + len > _hdr.out_size) return false;
+  if (!_io.write(_io.ctx, _out, data, len)) return false;
+  _out += len;
+  if (_hdr.kind == PZ_IMG_DEFLATE && _out == _hdr.out_size) _done = true;
+  return true;
+}
+
+// Rebuilds `len` bytes from the base at _src, adding `add` byte-wise when set.
+bool Decoder::copyBase(uint32_t len, const uint8_t* add) {
+  if (_src > _hdr.base_size || len > _hdr.base_size - _src) return false;
+  uint8_t tmp[256];
+  while (len) {
+    const uint32_t n = len < sizeof(tmp) ? len : sizeof(tmp);
+    if (!_io.readBase(_io.ctx, _src, tmp, n)) return false;
+    if (add) { for (uint32_t i = 0; i < n; i++) tmp[i] += add[i]; add += n; }
+    if (!out(tmp, n)) return false;
+    _src += n; len -= n;
+  }
+  return true;
+}
+
+bool Decoder::ops(const uint8_t* p, size_t len) {
+  while (len && !_done) {
+    if (!_op) {
+      _op = *p++; len--;
+      _argFill = 0; _haveArgs = false;
+      if (_op == PZ_IMG_OP_END) {
+        if (_out != _hdr.out_size) return false;
+        _done = true;
+        return true;
+      }
+      if (_op > PZ_IMG_OP_LIT) return false;
+      continue;
+    }
+
+    if (!_haveArgs) {
+      const uint8_t need = _op == PZ_IMG_OP_LIT ? 4 : 8;
+      while (len && _argFill < need) { _arg[_argFill++] = *p++; len--; }
+      if (_argFill < need) return true;
+      _haveArgs = true;
+      if (_op == PZ_IMG_OP_LIT) { _left = rdU32(_arg); }
+      else                      { _src = rdU32(_arg); _left = rdU32(_arg + 4); }
+      if (_op == PZ_IMG_OP_COPY) {
+        if (!copyBase(_left, nullptr)) return false;
+        _left = 0;
+      }
+    }
+
+    const uint32_t n = _left < len ? _left : (uint32_t)len;
+    if (n) {
+      if (_op == PZ_IMG_OP_ADD ? !copyBase(n, p) : !out(p, n)) return false;
+      p += n; len -= n; _left -= n;
+    }
+    if (!_left) _op = 0;
+  }
+  return true;
+}
+
+} // namespace OtaImage
@@ -0,0 +1,92 @@
+// File: PizzaShared/include/PizzaOtaImage.h
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Encoded OTA images: a 48-byte header followed by a raw deflate stream.
+//
+//   PZ_IMG_DEFLATE  the stream inflates to the new .bin
+//   PZ_IMG_DELTA    the stream inflates to ops that rebuild the new .bin from
+//                   the running app partition (bsdiff-style ADD keeps shifted
+//                   code with relocated addresses compressible):
+//                     0x01 COPY src:u32 len:u32            out = base[src..]
+//                     0x02 ADD  src:u32 len:u32 d[len]     out = base[src+i] + d[i]
+//                     0x03 LIT  len:u32 bytes[len]
+//                     0x00 END
+//
+// Plain .bin files start with 0xE9 and never look encoded. Decoder is fed the
+// download in arbitrary pieces and writes the output strictly sequentially.
+// Built with extras/tools/pz_img.py; extras/tools/pz_img_check.cpp replays
+// an image on the host.
+
+static const uint8_t PZ_IMG_MAGIC[4] = { 'P', 'Z', 'I', '1' };
+
+enum PzImgKind : uint8_t { PZ_IMG_DEFLATE = 1, PZ_IMG_DELTA = 2 };
+
+enum PzImgOp : uint8_t { PZ_IMG_OP_END = 0, PZ_IMG_OP_COPY = 1, PZ_IMG_OP_ADD = 2, PZ_IMG_OP_LIT = 3 };
+
+#pragma pack(push,1)
+struct PzImgHeader {
+  uint8_t  magic[4];
+  uint8_t  kind;         // PzImgKind
+  uint8_t  rsv[3];
+  uint32_t out_size;     // bytes of the rebuilt image
+  uint32_t base_size;    // delta: bytes of the running image the ops refer to
+  uint8_t  base_sha[32]; // delta: SHA-256 of running partition [0, base_size)
+};
+#pragma pack(pop)
+static_assert(sizeof(PzImgHeader) == 48, "PzImgHeader is 48 bytes on the wire");
+
+namespace OtaImage {
+  // True if `data` (the first bytes of a download) carries PZ_IMG_MAGIC.
+  bool isEncoded(const uint8_t* data, size_t len);
+
+  struct Io {
+    void* ctx;
+    bool (*write)(void* ctx, uint32_t off, const uint8_t* data, size_t len);
+    bool (*readBase)(void* ctx, uint32_t off, uint8_t* data, size_t len);
+    bool (*checkBase)(void* ctx, const PzImgHeader& h);   // delta only; may be slow
+  };
+
+  class Decoder {
+  public:
+    ~Decoder() { end(); }
+    bool begin(const Io& io);          // allocates ~44 KB (inflate window + state)
+    void end();
+    bool active() const { return _win != nullptr; }
+
+    // Consumes all of `data`; false once the image is malformed, the base
+    // does not match or a write fails (the decoder then stays failed).
+    bool feed(const uint8_t* data, size_t len);
+    bool done() const { return _done; }                  // END seen / full output written
+    uint32_t written() const { return _out; }
+    const PzImgHeader& header() const { return _hdr; }
+
+  private:
+    bool inflate(const uint8_t* in, size_t len);
+    bool emit(const uint8_t* data, size_t len);      // inflated bytes
+    bool ops(const uint8_t* data, size_t len);       // PZ_IMG_DELTA op stream
+    bool out(const uint8_t* data, size_t len);
+    bool copyBase(uint32_t len, const uint8_t* add);
+
+    Io          _io{};
+    PzImgHeader _hdr{};
+    uint8_t     _hdrFill = 0;
+    bool        _failed = false;
+    bool        _done = false;
+    uint32_t    _out = 0;
+
+    // inflate
+    void*       _inf = nullptr;      // tinfl_decompressor / z_stream
+    uint8_t*    _win = nullptr;      // 32 KB circular output window
+    uint32_t    _winPos = 0;
+
+    // op parser
+    uint8_t     _op = 0;             // current op, 0 = expecting an op byte
+    uint8_t     _arg[8];
+    uint8_t     _argFill = 0;
+    bool        _haveArgs = false;
+    uint32_t    _src = 0;
+    uint32_t    _left = 0;           // bytes of the current op still to produce
+  };
+}
@@ -0,0 +1,107 @@
+// File: PizzaShared/src/PizzaOtaManifest.cpp
+#include "PizzaOtaManifest.h"
+#include "PizzaUtils.h"
+#include <mbedtls/pk.h>
+
+namespace OtaManifest {
+
+static int hexNibble(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// Decodes exactly `n` bytes of hex; false on short or bad input.
+static bool unhex(const char* s, size_t sLen, uint8_t* out, size_t n) {
+  if (sLen != n * 2) return false;
+  for (size_t i = 0; i < n; i++) {
+    int hi = hexNibble(s[2*i]), lo = hexNibble(s[2*i + 1]);
+    if (hi < 0 || lo < 0) return false;
+    out[i] = (uint8_t)(hi << 4 | lo);
+  }
+  return true;
+}
+
+static bool checkSig(const char* signedText, size_t signedLen, const char* hex, size_t hexLen) {
+#ifdef PZ_OTA_PUBKEY_PEM
+  uint8_t der[256];
+  if (hexLen % 2 || hexLen / 2 > sizeof(der) || !unhex(hex, hexLen, der, hexLen / 2)) return false;
+  uint8_t digest[32];
+  mbedtls_sha256((const unsigned char*)signedText, signedLen, digest, 0);
+
+  static const char kPem[] = PZ_OTA_PUBKEY_PEM;
+  mbedtls_pk_context pk;
+  mbedtls_pk_init(&pk);
+  bool ok = mbedtls_pk_parse_public_key(&pk, (const unsigned char*)kPem, sizeof(kPem)) == 0 &&
+            mbedtls_pk_verify(&pk, MBEDTLS_MD_SHA256, digest, sizeof(digest), der, hexLen / 2) == 0;
+  mbedtls_pk_free(&pk);
+  return ok;
+#else
+  (void)signedText; (void)signedLen; (void)hex; (void)hexLen;
+  return false;                                  // no key compiled in: signature is ignored
+#endif
+}
+
+bool parse(const char* text, size_t len, Manifest& out) {
+  memset(&out, 0, sizeof(out));
+  bool magic = false;
+  size_t pos = 0;
+  while (pos < len) {
+    const size_t lineStart = pos;
+    size_t end = pos;
+    while (end < len && text[end] != '\n') end++;
+    pos = end + 1;
+
+    size_t lineEnd = end;
+    if (lineEnd > lineStart && text[lineEnd - 1] == '\r') lineEnd--;
+    const char* key = text + lineStart;
+    size_t sp = lineStart;
+    while (sp < lineEnd && text[sp] != ' ') sp++;
+    const size_t keyLen = sp - lineStart;
+    const char* val = text + sp + 1;
+    const size_t valLen = sp < lineEnd ? lineEnd - sp - 1 : 0;
+    if (!keyLen) continue;
+
+    char num[12] = {0};
+    if (valLen < sizeof(num)) memcpy(num, val, valLen);
+
+    if (keyLen == 5 && !memcmp(key, "pzota", 5)) {
+      magic = valLen == 1 && val[0] == '1';
+    } else if (keyLen == 7 && !memcmp(key, "version", 7)) {
+      if (valLen >= sizeof(out.version)) return false;
+      memcpy(out.version, val, valLen);
+    } else if (keyLen == 4 && !memcmp(key, "size", 4)) {
+      out.size = strtoul(num, nullptr, 10);
+    } else if (keyLen == 5 && !memcmp(key, "block", 5)) {
+      out.block = strtoul(num, nullptr, 10);
+    } else if (keyLen == 1 && key[0] == 'b') {
+      if (out.blocks >= OTA_MANIFEST_BLOCKS_MAX) {
+        PZ_LOGE("OTA manifest: more than %d blocks", OTA_MANIFEST_BLOCKS_MAX);
+        return false;
+      }
+      if (!unhex(val, valLen, out.hash[out.blocks], 32)) return false;
+      out.blocks++;
+    } else if (keyLen == 3 && !memcmp(key, "sig", 3)) {
+      out.sig = checkSig(text, lineStart, val, valLen);
+      if (!out.sig) PZ_LOGE("OTA manifest: signature not verified");
+      break;                                     // nothing after the signature counts
+    }
+  }
+
+  if (!magic || !out.size || !out.block || out.block % 4096) return false;
+  if (out.blocks != (out.size + out.block - 1) / out.block) return false;
+#ifdef PZ_OTA_PUBKEY_PEM
+  if (!out.sig) return false;
+#endif
+  return true;
+}
+
+bool BlockHasher::finish(const Manifest& m, uint16_t index) {
+  uint8_t digest[32];
+  mbedtls_sha256_finish(&_ctx, digest);
+  mbedtls_sha256_starts(&_ctx, 0);
+  return index < m.blocks && memcmp(digest, m.hash[index], sizeof(digest)) == 0;
+}
+
+} // namespace OtaManifest
@@ -0,0 +1,46 @@
+// File: PizzaShared/include/PizzaOtaManifest.h
+#pragma once
+#include <Arduino.h>
+#include <mbedtls/sha256.h>
+#include "BuildConfig.h"
+
+// Sidecar manifest fetched from "<image url>" OTA_MANIFEST_SUFFIX. Text, one
+// field per line:
+//
+//   pzota 1
+//   version 1.4.2
+//   size 1234567
+//   block 65536            multiple of 4096; also the HTTP Range size
+//   b <64 hex>             SHA-256 of each block, in order
+//   sig <hex DER>          optional: signature over SHA-256 of every byte
+//                          before this line (checked with PZ_OTA_PUBKEY_PEM)
+//
+// Blocks are hashed while they are written, so a corrupt block is rejected
+// as soon as it ends and no second pass over flash is needed.
+namespace OtaManifest {
+  struct Manifest {
+    char     version[24];
+    uint32_t size;
+    uint32_t block;
+    uint16_t blocks;
+    bool     sig;                                  // signature present and verified
+    uint8_t  hash[OTA_MANIFEST_BLOCKS_MAX][32];
+  };
+
+  // False if malformed, inconsistent, or (with PZ_OTA_PUBKEY_PEM defined)
+  // unsigned / badly signed.
+  bool parse(const char* text, size_t len, Manifest& out);
+
+  // Running SHA-256 of one block (hardware SHA engine via mbedtls).
+  class BlockHasher {
+  public:
+    BlockHasher()  { mbedtls_sha256_init(&_ctx); }
+    ~BlockHasher() { mbedtls_sha256_free(&_ctx); }
+    void begin() { mbedtls_sha256_starts(&_ctx, 0); }
+    void update(const uint8_t* d, size_t n) { mbedtls_sha256_update(&_ctx, d, n); }
+    // Ends the block and compares with the manifest entry; ready for the next one.
+    bool finish(const Manifest& m, uint16_t index);
+  private:
+    mbedtls_sha256_context _ctx;
+  };
+}
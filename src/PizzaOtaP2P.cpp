@@ -0,0 +1,495 @@
+// File: PizzaShared/src/PizzaOtaP2P.cpp
+#include "PizzaOtaP2P.h"
+#include "PizzaNow.h"
+#include "PizzaUtils.h"
+#include "BuildConfig.h"
+
+#include <freertos/FreeRTOS.h>
+#include <esp_partition.h>
+#include <esp_ota_ops.h>
+#include <mbedtls/sha256.h>
+
+namespace P2pOta {
+
+// NACK/JOIN/DONE (server) and DATA/POLL/OFFER (receiver) arrive in the
+// ESP-NOW task; everything touching flash runs from loop().
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static bool bitGet(const uint8_t* b, uint32_t i) { return b[i >> 3] & (1u << (i & 7)); }
+static void bitSet(uint8_t* b, uint32_t i)       { b[i >> 3] |= (uint8_t)(1u << (i & 7)); }
+static void bitClr(uint8_t* b, uint32_t i)       { b[i >> 3] &= (uint8_t)~(1u << (i & 7)); }
+
+static uint16_t chunkLen(const P2pOfferPayload& o, uint16_t idx) {
+  const uint32_t off = (uint32_t)idx * PZ_P2P_CHUNK;
+  return (uint16_t)(o.size - off < PZ_P2P_CHUNK ? o.size - off : PZ_P2P_CHUNK);
+}
+
+// SHA-256 of part[0, size) (hardware SHA via mbedtls).
+static bool hashPartition(const esp_partition_t* part, uint32_t size, uint8_t out[32]) {
+  mbedtls_sha256_context c;
+  mbedtls_sha256_init(&c);
+  mbedtls_sha256_starts(&c, 0);
+  uint8_t buf[1024];
+  bool ok = true;
+  for (uint32_t off = 0; ok && off < size; off += sizeof(buf)) {
+    const uint32_t n = size - off < sizeof(buf) ? size - off : sizeof(buf);
+    ok = esp_partition_read(part, off, buf, n) == ESP_OK;
+    if (ok) mbedtls_sha256_update(&c, buf, n);
+  }
+  mbedtls_sha256_finish(&c, out);
+  mbedtls_sha256_free(&c);
+  return ok;
+}
+
+// ===== Server =====
+enum SrvPhase : uint8_t { SRV_IDLE, SRV_OFFER, SRV_STREAM, SRV_COLLECT };
+
+struct RxPeer {
+  uint8_t mac[6];
+  uint8_t done;          // 0 = receiving, 1 = ok, 2 = failed
+};
+
+static SrvPhase               s_srv = SRV_IDLE;
+static P2pOfferPayload        s_offer;
+static const esp_partition_t* s_srcPart  = nullptr;
+static uint8_t*               s_resend   = nullptr;   // bit per chunk: NACKed, not yet resent
+static uint16_t               s_cursor   = 0;         // next chunk never sent
+static uint16_t               s_winEnd   = 0;
+static uint8_t                s_rounds   = 0;
+static uint8_t                s_quiet    = 0;
+static volatile bool          s_nacked   = false;     // NACK since the last POLL
+static uint32_t               s_phaseMs  = 0;
+static uint32_t               s_offerMs  = 0;
+static uint32_t               s_startMs  = 0;
+static RxPeer                 s_rx[PZ_P2P_RX_MAX];
+static uint8_t                s_nRx      = 0;
+static ServeStats             s_stats;
+
+static void sendOffer() {
+  s_offerMs = millis();
+  PizzaNow::sendMsg(P2P_OFFER, &s_offer, sizeof(s_offer));
+}
+
+static void sendPoll(uint16_t upto) {
+  P2pPollPayload p{ s_offer.session, upto };
+  s_nacked = false;
+  s_stats.polls++;
+  PizzaNow::sendMsg(P2P_POLL, &p, sizeof(p));
+}
+
+static bool sendData(uint16_t idx) {
+  uint8_t buf[sizeof(P2pDataHeader) + PZ_P2P_CHUNK];
+  P2pDataHeader h{ s_offer.session, idx };
+  const uint16_t n = chunkLen(s_offer, idx);
+  memcpy(buf, &h, sizeof(h));
+  if (esp_partition_read(s_srcPart, (uint32_t)idx * PZ_P2P_CHUNK, buf + sizeof(h), n) != ESP_OK) return false;
+  if (!PizzaNow::sendMsg(P2P_DATA, buf, sizeof(h) + n)) return false;   // radio queue full: try later
+  s_stats.sent++;
+  return true;
+}
+
+// Lowest NACKed chunk below `limit`, cleared; -1 if none.
+static int32_t takeResend(uint16_t limit) {
+  int32_t found = -1;
+  portENTER_CRITICAL(&s_mux);
+  for (uint32_t byte = 0; byte * 8 < limit && found < 0; byte++) {
+    if (!s_resend[byte]) continue;
+    for (uint32_t i = byte * 8; i < byte * 8 + 8 && i < limit; i++) {
+      if (bitGet(s_resend, i)) { bitClr(s_resend, i); found = (int32_t)i; break; }
+    }
+  }
+  portEXIT_CRITICAL(&s_mux);
+  return found;
+}
+
+static void finishServe(const char* why) {
+  PZ_LOGI("P2pOta: v%s %s after %lus: %u joined, %u ok, %u failed, %lu frames (%lu resent)",
+          s_offer.ver, why, (unsigned long)((millis() - s_startMs) / 1000),
+          s_stats.joined, s_stats.ok, s_stats.failed,
+          (unsigned long)s_stats.sent, (unsigned long)s_stats.resent);
+  stop();
+}
+
+static bool allDone() {
+  if (!s_nRx) return false;
+  for (uint8_t i = 0; i < s_nRx; i++) if (!s_rx[i].done) return false;
+  return true;
+}
+
+static void serverLoop() {
+  const uint32_t now = millis();
+  if ((uint32_t)(now - s_startMs) > PZ_P2P_TOTAL_MS) { finishServe("timed out"); return; }
+  // Keep offering while streaming so late receivers join (they catch up in the final polls).
+  if ((uint32_t)(now - s_offerMs) >= (s_srv == SRV_OFFER ? PZ_P2P_OFFER_EVERY_MS : 4 * PZ_P2P_OFFER_EVERY_MS)) {
+    sendOffer();
+  }
+
+  switch (s_srv) {
+    case SRV_OFFER:
+      if ((uint32_t)(now - s_phaseMs) < PZ_P2P_OFFER_MS) return;
+      if (!s_nRx) { finishServe("got no receivers"); return; }
+      s_winEnd = s_offer.chunks < PZ_P2P_WINDOW ? s_offer.chunks : PZ_P2P_WINDOW;
+      s_srv    = SRV_STREAM;
+      return;
+
+    case SRV_STREAM:
+      for (uint8_t b = 0; b < PZ_P2P_BURST; b++) {
+        int32_t idx = takeResend(s_winEnd);
+        const bool fresh = idx < 0;
+        if (fresh) {
+          if (s_cursor >= s_winEnd) {
+            sendPoll(s_winEnd);
+            s_srv = SRV_COLLECT;
+            s_phaseMs = now;
+            return;
+          }
+          idx = s_cursor;
+        }
+        if (!sendData((uint16_t)idx)) {
+          if (!fresh) { portENTER_CRITICAL(&s_mux); bitSet(s_resend, (uint32_t)idx); portEXIT_CRITICAL(&s_mux); }
+          return;
+        }
+        if (fresh) s_cursor++;
+        else       s_stats.resent++;
+      }
+      return;
+
+    case SRV_COLLECT:
+      if ((uint32_t)(now - s_phaseMs) < PZ_P2P_NACK_MS) return;
+      if (s_winEnd < s_offer.chunks) {
+        if (s_nacked && s_rounds < PZ_P2P_ROUNDS) {
+          s_rounds++;
+        } else {
+          // Leftover NACKs stay queued and go out with the next window.
+          s_rounds = 0;
+          s_winEnd = (uint16_t)(s_offer.chunks - s_winEnd < PZ_P2P_WINDOW ? s_offer.chunks
+                                                                          : s_winEnd + PZ_P2P_WINDOW);
+        }
+      } else {
+        s_quiet = s_nacked ? 0 : s_quiet + 1;
+        if (allDone() || s_quiet >= PZ_P2P_QUIET_POLLS) { finishServe("finished"); return; }
+      }
+      s_srv = SRV_STREAM;
+      return;
+
+    default:
+      return;
+  }
+}
+
+static void serverRx(const MsgHeader& hdr, const uint8_t* p, uint16_t len, const uint8_t mac[6]) {
+  if (len < 2) return;
+  uint16_t session;
+  memcpy(&session, p, 2);
+
+  portENTER_CRITICAL(&s_mux);
+  if (s_srv == SRV_IDLE || !s_resend || session != s_offer.session) {
+    portEXIT_CRITICAL(&s_mux);
+    return;
+  }
+  RxPeer* peer = nullptr;
+  for (uint8_t i = 0; i < s_nRx; i++) if (memcmp(s_rx[i].mac, mac, 6) == 0) { peer = &s_rx[i]; break; }
+  if (!peer && s_nRx < PZ_P2P_RX_MAX) {
+    peer = &s_rx[s_nRx++];
+    memcpy(peer->mac, mac, 6);
+    peer->done = 0;
+    s_stats.joined++;
+  }
+
+  if (hdr.type == P2P_NACK && len >= sizeof(P2pNackPayload)) {
+    P2pNackPayload n;
+    memcpy(&n, p, sizeof(n));
+    for (uint32_t i = 0; i < PZ_P2P_NACK_BITS && n.base + i < s_offer.chunks; i++) {
+      if (bitGet(n.bits, i)) bitSet(s_resend, n.base + i);
+    }
+    s_nacked = true;
+  } else if (hdr.type == P2P_DONE && len >= sizeof(P2pDonePayload) && peer && !peer->done) {
+    P2pDonePayload d;
+    memcpy(&d, p, sizeof(d));
+    peer->done = d.ok ? 1 : 2;
+    if (d.ok) s_stats.ok++; else s_stats.failed++;
+  }
+  portEXIT_CRITICAL(&s_mux);
+}
+
+bool serve(uint8_t targetRole, const char* ver) {
+  if (s_srv != SRV_IDLE || !ver || strlen(ver) >= sizeof(s_offer.ver)) return false;
+  s_srcPart = esp_ota_get_running_partition();
+  const uint32_t size = ESP.getSketchSize();
+  if (!s_srcPart || !size || (size + PZ_P2P_CHUNK - 1) / PZ_P2P_CHUNK > 0xFFFF) return false;
+
+  memset(&s_offer, 0, sizeof(s_offer));
+  s_offer.session     = (uint16_t)(esp_random() | 1);
+  s_offer.target_role = targetRole;
+  strlcpy(s_offer.ver, ver, sizeof(s_offer.ver));
+  s_offer.size        = size;
+  s_offer.chunks      = (uint16_t)((size + PZ_P2P_CHUNK - 1) / PZ_P2P_CHUNK);
+  if (!hashPartition(s_srcPart, size, s_offer.sha256)) return false;
+
+  s_resend = (uint8_t*)calloc((s_offer.chunks + 7) / 8, 1);
+  if (!s_resend) { PZ_LOGE("P2pOta: alloc failed"); return false; }
+
+  memset(&s_stats, 0, sizeof(s_stats));
+  s_stats.chunks = s_offer.chunks;
+  s_nRx = 0; s_cursor = 0; s_rounds = 0; s_quiet = 0; s_nacked = false;
+  s_startMs = s_phaseMs = millis();
+  s_srv = SRV_OFFER;
+  sendOffer();
+  PZ_LOGI("P2pOta: serving v%s (%u bytes, %u chunks) to role %u",
+          ver, (unsigned)size, (unsigned)s_offer.chunks, targetRole);
+  return true;
+}
+
+void stop() {
+  portENTER_CRITICAL(&s_mux);
+  s_srv = SRV_IDLE;
+  uint8_t* r = s_resend;
+  s_resend = nullptr;
+  portEXIT_CRITICAL(&s_mux);
+  free(r);
+}
+
+bool serving() { return s_srv != SRV_IDLE; }
+
+void serveStats(ServeStats& out) {
+  portENTER_CRITICAL(&s_mux);
+  out = s_stats;
+  portEXIT_CRITICAL(&s_mux);
+}
+
+// ===== Receiver =====
+struct RxChunk {
+  uint16_t idx;
+  uint8_t  len;
+  uint8_t  data[PZ_P2P_CHUNK];
+};
+
+static bool                   s_listen   = false;
+static uint8_t                s_myRole   = 0;
+static char                   s_myVer[12];
+static PizzaOta::ProgressCB   s_cb       = nullptr;
+
+static bool                   s_active   = false;
+static P2pOfferPayload        s_in;                   // offer being received
+static uint8_t                s_srvMac[6];
+static const esp_partition_t* s_dstPart  = nullptr;
+static uint8_t*               s_have     = nullptr;   // bit per chunk
+static uint8_t*               s_erased   = nullptr;   // bit per partition sector
+static uint16_t               s_got      = 0;
+static uint32_t               s_lastRxMs = 0;
+static uint16_t               s_failed   = 0;         // session that failed here; not rejoined
+
+static volatile bool          s_offerPending = false;
+static P2pOfferPayload        s_offerIn;
+static uint8_t                s_offerMac[6];
+static volatile bool          s_pollPending  = false;
+static uint16_t               s_pollUpto     = 0;
+static uint32_t               s_pollDueMs    = 0;
+
+static RxChunk                s_ring[PZ_P2P_RING];
+static uint8_t                s_head = 0, s_tail = 0;   // s_head == s_tail: empty
+
+static void receiverRx(const MsgHeader& hdr, const uint8_t* p, uint16_t len, const uint8_t mac[6]) {
+  if (hdr.type == P2P_OFFER && len >= sizeof(P2pOfferPayload)) {
+    if (!s_listen) return;
+    portENTER_CRITICAL(&s_mux);
+    memcpy(&s_offerIn, p, sizeof(s_offerIn));
+    memcpy(s_offerMac, mac, 6);
+    s_offerPending = true;
+    portEXIT_CRITICAL(&s_mux);
+    return;
+  }
+  if (len < 2) return;
+  uint16_t session;
+  memcpy(&session, p, 2);
+
+  portENTER_CRITICAL(&s_mux);
+  if (s_active && session == s_in.session) {
+    s_lastRxMs = millis();
+    if (hdr.type == P2P_DATA && len > sizeof(P2pDataHeader)) {
+      P2pDataHeader h;
+      memcpy(&h, p, sizeof(h));
+      const uint16_t n = len - sizeof(h);
+      const uint8_t next = (uint8_t)((s_head + 1) % PZ_P2P_RING);
+      // Ring full: dropped, NACKed later.
+      if (h.idx < s_in.chunks && n == chunkLen(s_in, h.idx) && !bitGet(s_have, h.idx) && next != s_tail) {
+        s_ring[s_head].idx = h.idx;
+        s_ring[s_head].len = (uint8_t)n;
+        memcpy(s_ring[s_head].data, p + sizeof(h), n);
+        s_head = next;
+      }
+    } else if (hdr.type == P2P_POLL && len >= sizeof(P2pPollPayload)) {
+      P2pPollPayload q;
+      memcpy(&q, p, sizeof(q));
+      s_pollUpto    = q.upto;
+      s_pollDueMs   = millis() + esp_random() % PZ_P2P_NACK_JITTER_MS;
+      s_pollPending = true;
+    }
+  }
+  portEXIT_CRITICAL(&s_mux);
+}
+
+static void release() {
+  portENTER_CRITICAL(&s_mux);
+  s_active = false;
+  s_head = s_tail = 0;
+  s_pollPending = false;
+  portEXIT_CRITICAL(&s_mux);
+  free(s_have);   s_have = nullptr;
+  free(s_erased); s_erased = nullptr;
+}
+
+static void sendDone(bool ok, uint8_t code) {
+  P2pDonePayload d{ s_in.session, (uint8_t)(ok ? 1 : 0), code };
+  PizzaNow::sendMsg(P2P_DONE, &d, sizeof(d), s_srvMac);
+}
+
+static void abortRx(PizzaOta::Result code, const char* why) {
+  PZ_LOGE("P2pOta: v%s aborted: %s", s_in.ver, why);
+  sendDone(false, code);
+  s_failed = s_in.session;
+  release();
+}
+
+static void acceptOffer() {
+  P2pOfferPayload o;
+  uint8_t mac[6];
+  portENTER_CRITICAL(&s_mux);
+  memcpy(&o, &s_offerIn, sizeof(o));
+  memcpy(mac, s_offerMac, 6);
+  s_offerPending = false;
+  portEXIT_CRITICAL(&s_mux);
+
+  if (s_active) {
+    if (o.session == s_in.session) {
+      P2pJoinPayload j{ o.session };             // our JOIN may have been lost
+      PizzaNow::sendMsg(P2P_JOIN, &j, sizeof(j), s_srvMac);
+    }
+    return;
+  }
+  if (o.target_role != s_myRole || o.session == s_failed) return;
+  if (strncmp(o.ver, s_myVer, sizeof(o.ver)) == 0) return;
+  if (o.chunks != (o.size + PZ_P2P_CHUNK - 1) / PZ_P2P_CHUNK) return;
+
+  s_dstPart = esp_ota_get_next_update_partition(nullptr);
+  if (!s_dstPart || o.size > s_dstPart->size) return;
+  const uint32_t sectors = (s_dstPart->size + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE;
+  s_have   = (uint8_t*)calloc((o.chunks + 7) / 8, 1);
+  s_erased = (uint8_t*)calloc((sectors + 7) / 8, 1);
+  if (!s_have || !s_erased) { release(); PZ_LOGE("P2pOta: alloc failed"); return; }
+
+  memcpy(&s_in, &o, sizeof(s_in));
+  memcpy(s_srvMac, mac, 6);
+  s_got      = 0;
+  s_lastRxMs = millis();
+  portENTER_CRITICAL(&s_mux);
+  s_active   = true;
+  portEXIT_CRITICAL(&s_mux);
+  P2pJoinPayload j{ o.session };
+  PizzaNow::sendMsg(P2P_JOIN, &j, sizeof(j), s_srvMac);
+  PZ_LOGI("P2pOta: receiving v%s (%u bytes) from %02X:%02X:%02X",
+          o.ver, (unsigned)o.size, mac[3], mac[4], mac[5]);
+  if (s_cb) s_cb(0, o.size);
+}
+
+// Writes one chunk; sectors are erased the first time any chunk lands in them.
+static bool writeChunk(const RxChunk& c) {
+  const uint32_t off = (uint32_t)c.idx * PZ_P2P_CHUNK;
+  for (uint32_t s = off / SPI_FLASH_SEC_SIZE; s <= (off + c.len - 1) / SPI_FLASH_SEC_SIZE; s++) {
+    if (bitGet(s_erased, s)) continue;
+    if (esp_partition_erase_range(s_dstPart, s * SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE) != ESP_OK) return false;
+    bitSet(s_erased, s);
+  }
+  return esp_partition_write(s_dstPart, off, c.data, c.len) == ESP_OK;
+}
+
+static void sendNack() {
+  s_pollPending = false;
+  P2pNackPayload n{};
+  n.session = s_in.session;
+  uint32_t i = 0;
+  while (i < s_pollUpto && bitGet(s_have, i)) i++;
+  if (i >= s_pollUpto) return;                    // nothing missing: stay quiet
+  n.base = (uint16_t)i;
+  for (uint32_t k = 0; k < PZ_P2P_NACK_BITS && n.base + k < s_in.chunks; k++) {
+    if (!bitGet(s_have, n.base + k)) bitSet(n.bits, k);
+  }
+  PizzaNow::sendMsg(P2P_NACK, &n, sizeof(n), s_srvMac);
+}
+
+static void complete() {
+  uint8_t digest[32];
+  if (!hashPartition(s_dstPart, s_in.size, digest) || memcmp(digest, s_in.sha256, sizeof(digest)) != 0) {
+    abortRx(PizzaOta::VERIFY_FAIL, "SHA-256 mismatch");
+    return;
+  }
+  if (esp_ota_set_boot_partition(s_dstPart) != ESP_OK) {
+    abortRx(PizzaOta::UPDATE_FAIL, "image rejected");
+    return;
+  }
+  sendDone(true, PizzaOta::OK);
+  if (s_cb) s_cb(1, 1);
+  PZ_LOGI("P2pOta: v%s OK, rebooting", s_in.ver);
+  const uint32_t t0 = millis();
+  do { PizzaNow::loop(); delay(5); } while (millis() - t0 < OTA_DONE_HOLD_MS);   // DONE goes out
+  ESP.restart();
+}
+
+static void receiverLoop() {
+  if (s_offerPending) acceptOffer();
+  if (!s_active) return;
+
+  for (;;) {
+    RxChunk c;
+    portENTER_CRITICAL(&s_mux);
+    const bool any = s_tail != s_head;
+    if (any) { c = s_ring[s_tail]; s_tail = (uint8_t)((s_tail + 1) % PZ_P2P_RING); }
+    portEXIT_CRITICAL(&s_mux);
+    if (!any) break;
+    if (bitGet(s_have, c.idx)) continue;          // queued twice before the first write
+    if (!writeChunk(c)) { abortRx(PizzaOta::UPDATE_FAIL, "flash write failed"); return; }
+    portENTER_CRITICAL(&s_mux);
+    bitSet(s_have, c.idx);
+    portEXIT_CRITICAL(&s_mux);
+    s_got++;
+    if (s_cb) s_cb((size_t)s_got * PZ_P2P_CHUNK < s_in.size ? (size_t)s_got * PZ_P2P_CHUNK : s_in.size, s_in.size);
+  }
+
+  if (s_got == s_in.chunks) { complete(); return; }
+  if (s_pollPending && (int32_t)(millis() - s_pollDueMs) >= 0) sendNack();
+  if ((uint32_t)(millis() - s_lastRxMs) > PZ_P2P_IDLE_MS) abortRx(PizzaOta::TIMEOUT, "server went quiet");
+}
+
+void listen(uint8_t myRole, const char* myVer) {
+  s_myRole = myRole;
+  strlcpy(s_myVer, myVer ? myVer : "", sizeof(s_myVer));
+  s_listen = true;
+}
+
+void setProgressCallback(PizzaOta::ProgressCB cb) { s_cb = cb; }
+bool receiving() { return s_active; }
+
+// ===== Shared =====
+bool handle(const MsgHeader& hdr, const uint8_t* payload, uint16_t len, const uint8_t mac[6]) {
+  switch (hdr.type) {
+    case P2P_JOIN:
+    case P2P_NACK:
+    case P2P_DONE:
+      serverRx(hdr, payload, len, mac);
+      return true;
+    case P2P_OFFER:
+    case P2P_DATA:
+    case P2P_POLL:
+      receiverRx(hdr, payload, len, mac);
+      return true;
+    default:
+      return false;
+  }
+}
+
+void loop() {
+  if (s_srv != SRV_IDLE) serverLoop();
+  receiverLoop();
+}
+
+} // namespace P2pOta
@@ -0,0 +1,45 @@
+// File: PizzaShared/include/PizzaOtaP2P.h
+#pragma once
+#include <Arduino.h>
+#include "PizzaProtocol.h"
+#include "PizzaOta.h"
+
+// Firmware distribution over ESP-NOW, no AP or HTTP server needed.
+//
+// A server (Central, or any node already running the new image) offers its
+// own running image with P2P_OFFER, then broadcasts it in PZ_P2P_CHUNK-byte
+// P2P_DATA frames, PZ_P2P_WINDOW chunks at a time. After each window it sends
+// P2P_POLL; receivers answer with a P2P_NACK bitmap of their lowest missing
+// chunks (silence = complete) and the server rebroadcasts the union. Every
+// receiver listens to the same stream, so N devices cost about one image of
+// airtime. After the last window the server keeps polling until no one NACKs.
+//
+// Receivers write chunks into the next OTA partition as they arrive (any
+// order; sectors are erased on first touch), then check the SHA-256 from the
+// offer, switch the boot partition, send P2P_DONE and reboot.
+namespace P2pOta {
+  // Feed every received message; returns true for P2P_* messages.
+  bool handle(const MsgHeader& hdr, const uint8_t* payload, uint16_t len, const uint8_t mac[6]);
+  void loop();
+
+  // ----- Server -----
+  // Serves the running image as version `ver` to devices of `targetRole`.
+  bool serve(uint8_t targetRole, const char* ver);
+  void stop();
+  bool serving();
+
+  struct ServeStats {
+    uint8_t  joined, ok, failed;
+    uint16_t chunks;
+    uint32_t sent;         // P2P_DATA frames, including resends
+    uint32_t resent;
+    uint16_t polls;
+  };
+  void serveStats(ServeStats& out);
+
+  // ----- Receiver -----
+  // Accepts offers for `myRole` whose version differs from `myVer`.
+  void listen(uint8_t myRole, const char* myVer);
+  void setProgressCallback(PizzaOta::ProgressCB cb);   // chunks received, as bytes
+  bool receiving();
+}
@@ -1,9 +1,57 @@
 #include "PizzaProtocol.h"
+#include "BuildConfig.h"
 
-namespace PizzaProtocol {
+#if defined(ARDUINO_ARCH_ESP32) && defined(__has_include)
+  #if __has_include(<esp_rom_crc.h>)
+    #include <esp_rom_crc.h>
+    #define PZ_HAVE_ROM_CRC 1
+  #endif
+#endif
+#ifndef PZ_HAVE_ROM_CRC
+  #define PZ_HAVE_ROM_CRC 0
+#endif
 
-uint16_t crc16(const uint8_t* data, size_t len) {
-  uint16_t crc = 0xFFFF;
+// ===== CRC tables (built at compile time) =====
+// T0[n] is the CRC of byte n from a zero state; Tk[n] is T0[n] followed by k
+// zero bytes. Slice-by-N folds N input bytes per step using T0..T(N-1).
+namespace {
+
+constexpr uint16_t crcShift(uint16_t c, int k) {
+  return k == 0 ? c
+       : crcShift((uint16_t)((c & 0x8000) ? ((c << 1) ^ 0x1021) : (c << 1)), k - 1);
+}
+constexpr uint16_t crcByte(uint16_t n)  { return crcShift((uint16_t)(n << 8), 8); }
+constexpr uint16_t crcZero(uint16_t v)  { return (uint16_t)((v << 8) ^ crcByte(v >> 8)); }
+constexpr uint16_t crcSlice(int k, uint16_t n) {
+  return k == 0 ? crcByte(n) : crcZero(crcSlice(k - 1, n));
+}
+
+#define PZ_CRC_R4(k, n)   crcSlice(k, (n)), crcSlice(k, (n)+1), crcSlice(k, (n)+2), crcSlice(k, (n)+3)
+#define PZ_CRC_R16(k, n)  PZ_CRC_R4(k, (n)), PZ_CRC_R4(k, (n)+4), PZ_CRC_R4(k, (n)+8), PZ_CRC_R4(k, (n)+12)
+#define PZ_CRC_R64(k, n)  PZ_CRC_R16(k, (n)), PZ_CRC_R16(k, (n)+16), PZ_CRC_R16(k, (n)+32), PZ_CRC_R16(k, (n)+48)
+#define PZ_CRC_R256(k)    { PZ_CRC_R64(k, 0), PZ_CRC_R64(k, 64), PZ_CRC_R64(k, 128), PZ_CRC_R64(k, 192) }
+
+constexpr uint16_t T0[256] = PZ_CRC_R256(0);
+constexpr uint16_t T1[256] = PZ_CRC_R256(1);
+constexpr uint16_t T2[256] = PZ_CRC_R256(2);
+constexpr uint16_t T3[256] = PZ_CRC_R256(3);
+constexpr uint16_t T4[256] = PZ_CRC_R256(4);
+constexpr uint16_t T5[256] = PZ_CRC_R256(5);
+constexpr uint16_t T6[256] = PZ_CRC_R256(6);
+constexpr uint16_t T7[256] = PZ_CRC_R256(7);
+
+#undef PZ_CRC_R4
+#undef PZ_CRC_R16
+#undef PZ_CRC_R64
+#undef PZ_CRC_R256
+
+static_assert(T0[1] == 0x1021, "CRC table generation broken");
+
+inline uint16_t tableStep(uint16_t crc, uint8_t b) {
+  return (uint16_t)((crc << 8) ^ T0[(uint8_t)((crc >> 8) ^ b)]);
+}
+
+uint16_t updBitwise(uint16_t crc, const uint8_t* data, size_t len) {
   while (len--) {
     crc ^= (uint16_t)(*data++) << 8;
     for (uint8_t i=0;i<8;i++) {
@@ -14,11 +62,74 @@ uint16_t crc16(const uint8_t* data, size_t len) {
   return crc;
 }
 
+uint16_t updTable(uint16_t crc, const uint8_t* data, size_t len) {
+  while (len--) crc = tableStep(crc, *data++);
+  return crc;
+}
+
+uint16_t updSlice4(uint16_t crc, const uint8_t* p, size_t len) {
+  while (len >= 4) {
+    crc ^= (uint16_t)((p[0] << 8) | p[1]);
+    crc = T3[crc >> 8] ^ T2[crc & 0xFF] ^ T1[p[2]] ^ T0[p[3]];
+    p += 4; len -= 4;
+  }
+  return updTable(crc, p, len);
+}
+
+uint16_t updSlice8(uint16_t crc, const uint8_t* p, size_t len) {
+  while (len >= 8) {
+    crc ^= (uint16_t)((p[0] << 8) | p[1]);
+    crc = T7[crc >> 8] ^ T6[crc & 0xFF] ^ T5[p[2]] ^ T4[p[3]]
+        ^ T3[p[4]]     ^ T2[p[5]]       ^ T1[p[6]] ^ T0[p[7]];
+    p += 8; len -= 8;
+  }
+  return updSlice4(crc, p, len);
+}
+
+uint16_t updRom(uint16_t crc, const uint8_t* data, size_t len) {
+#if PZ_HAVE_ROM_CRC
+  // The ROM routine inverts on entry and exit; undo both to get plain CCITT-FALSE.
+  return (uint16_t)~esp_rom_crc16_be((uint16_t)~crc, data, (uint32_t)len);
+#else
+  return updTable(crc, data, len);
+#endif
+}
+
+} // namespace
+
+namespace PizzaProtocol {
+
+uint16_t crc16Bitwise(const uint8_t* data, size_t len) { return updBitwise(0xFFFF, data, len); }
+uint16_t crc16Table(const uint8_t* data, size_t len)   { return updTable(0xFFFF, data, len); }
+uint16_t crc16Slice4(const uint8_t* data, size_t len)  { return updSlice4(0xFFFF, data, len); }
+uint16_t crc16Slice8(const uint8_t* data, size_t len)  { return updSlice8(0xFFFF, data, len); }
+uint16_t crc16Rom(const uint8_t* data, size_t len)     { return updRom(0xFFFF, data, len); }
+bool     crc16HasRom() { return PZ_HAVE_ROM_CRC != 0; }
+
+uint16_t crc16Update(uint16_t crc, const void* data, size_t len) {
+  const uint8_t* p = (const uint8_t*)data;
+#if   PZ_CRC_ENGINE == PZ_CRC_BITWISE
+  return updBitwise(crc, p, len);
+#elif PZ_CRC_ENGINE == PZ_CRC_SLICE4
+  return updSlice4(crc, p, len);
+#elif PZ_CRC_ENGINE == PZ_CRC_SLICE8
+  return updSlice8(crc, p, len);
+#elif PZ_CRC_ENGINE == PZ_CRC_ROM
+  return updRom(crc, p, len);
+#else
+  return updTable(crc, p, len);
+#endif
+}
+
+uint16_t crc16(const uint8_t* data, size_t len) {
+  return crc16Update(CRC16_INIT, data, len);
+}
+
 size_t pack(uint8_t type, Role role, uint8_t house_id,
             uint16_t seq, const void* payload, uint16_t payload_len,
             uint8_t* outBuf, uint16_t outMax) {
   if (!outBuf) return 0;
-  if (payload_len > 200) return 0;                // keep ESPNOW happy
+  if (payload_len > PZ_PAYLOAD_MAX) return 0;     // keep ESPNOW happy
   if (outMax < sizeof(MsgHeader) + payload_len) return 0;
 
   MsgHeader hdr;
@@ -29,14 +140,14 @@ size_t pack(uint8_t type, Role role, uint8_t house_id,
   hdr.len      = payload_len;
   hdr.crc16    = 0;
 
-  // copy header+payload
+  // Hash each piece as it is written: header (with crc16=0), then payload.
   memcpy(outBuf, &hdr, sizeof(hdr));
-  if (payload && payload_len) {
-    memcpy(outBuf + sizeof(hdr), payload, payload_len);
+  uint16_t crc = crc16Update(CRC16_INIT, &hdr, sizeof(hdr));
+  if (payload_len) {
+    if (payload) memcpy(outBuf + sizeof(hdr), payload, payload_len);
+    crc = crc16Update(crc, outBuf + sizeof(hdr), payload_len);
   }
 
-  // compute CRC over header (with crc16=0) + payload
-  uint16_t crc = crc16(outBuf, sizeof(hdr) + payload_len);
   // write crc into buffer
   ((MsgHeader*)outBuf)->crc16 = crc;
   return sizeof(hdr) + payload_len;
@@ -49,16 +160,12 @@ bool unpack(const uint8_t* inBuf, uint16_t inLen,
   memcpy(&outHdr, inBuf, sizeof(MsgHeader));
   if (inLen != sizeof(MsgHeader) + outHdr.len) return false;
 
-  // Recompute CRC with crc16 field zeroed
-  const size_t total = sizeof(MsgHeader) + outHdr.len;
-  if (total > 256) return false; // our safety cap (payload limited elsewhere)
-
-  uint8_t tmp[256];
-  MsgHeader hdr0 = outHdr; hdr0.crc16 = 0;
-  memcpy(tmp, &hdr0, sizeof(MsgHeader));
-  memcpy(tmp + sizeof(MsgHeader), inBuf + sizeof(MsgHeader), outHdr.len);
-
-  uint16_t calc = crc16(tmp, total);
+  // Recompute CRC in place as if the crc16 field were zero:
+  // header prefix, two zero bytes, then the payload straight from inBuf.
+  static const uint8_t kZeroCrc[2] = { 0, 0 };
+  uint16_t calc = crc16Update(CRC16_INIT, inBuf, offsetof(MsgHeader, crc16));
+  calc = crc16Update(calc, kZeroCrc, sizeof(kZeroCrc));
+  calc = crc16Update(calc, inBuf + sizeof(MsgHeader), outHdr.len);
   if (calc != outHdr.crc16) return false;
 
   outPayload = inBuf + sizeof(MsgHeader);
@@ -67,3 +174,195 @@ bool unpack(const uint8_t* inBuf, uint16_t inLen,
 }
 
 } // namespace
+
+// ===== Compact (v3) encoding =====
+namespace {
+
+struct Writer {
+  uint8_t* p;
+  uint16_t left;
+  bool     ok;
+
+  void u8(uint8_t v) {
+    if (!left) { ok = false; return; }
+    *p++ = v; left--;
+  }
+  void u16(uint16_t v) { u8((uint8_t)v); u8((uint8_t)(v >> 8)); }
+  // Fixed char[] field -> <len><bytes>, dropping the NUL padding.
+  void str(const char* s, size_t cap) {
+    size_t n = strnlen(s, cap);
+    if (n > 255) n = 255;
+    u8((uint8_t)n);
+    if (n > left) { ok = false; return; }
+    memcpy(p, s, n); p += n; left -= n;
+  }
+};
+
+struct Reader {
+  const uint8_t* p;
+  uint16_t       left;
+  bool           ok;
+
+  uint8_t u8() {
+    if (!left) { ok = false; return 0; }
+    left--; return *p++;
+  }
+  uint16_t u16() { uint16_t lo = u8(); return (uint16_t)(lo | (u8() << 8)); }
+  PzStr str() {
+    PzStr s{ nullptr, u8() };
+    if (s.len > left) { ok = false; s.len = 0; return s; }
+    s.ptr = (const char*)p; p += s.len; left -= s.len;
+    return s;
+  }
+  bool done() const { return ok && left == 0; }
+};
+
+// View -> fixed char[] field (NUL-padded, truncated to fit).
+void toField(const PzStr& s, char* dst, size_t cap) {
+  size_t n = s.len < cap - 1 ? s.len : cap - 1;
+  memset(dst, 0, cap);
+  if (n) memcpy(dst, s.ptr, n);
+}
+
+} // namespace
+
+namespace PizzaProtocol {
+
+uint8_t compactType(uint8_t type) {
+  switch (type) {
+    case PANEL_TEXT:      return PANEL_TEXT_C;
+    case ORDER_ITEM_SET:  return ORDER_ITEM_SET_C;
+    case ORDER_SHOW_TEXT: return ORDER_SHOW_TEXT_C;
+    case NET_CFG_SET:     return NET_CFG_SET_C;
+    default:              return 0;
+  }
+}
+
+uint8_t legacyType(uint8_t ctype) {
+  switch (ctype) {
+    case PANEL_TEXT_C:      return PANEL_TEXT;
+    case ORDER_ITEM_SET_C:  return ORDER_ITEM_SET;
+    case ORDER_SHOW_TEXT_C: return ORDER_SHOW_TEXT;
+    case NET_CFG_SET_C:     return NET_CFG_SET;
+    default:                return 0;
+  }
+}
+
+uint16_t encodeCompact(uint8_t type, const void* payload, uint16_t len,
+                       uint8_t* out, uint16_t outMax) {
+  if (!payload || !out) return 0;
+  Writer w{ out, outMax, true };
+
+  switch (type) {
+    case PANEL_TEXT: {
+      if (len != sizeof(PanelTextPayload)) return 0;
+      PanelTextPayload v; memcpy(&v, payload, sizeof(v));
+      w.u8(v.house_id); w.u8(v.style); w.u8(v.speed); w.u8(v.bright);
+      w.str(v.text, sizeof(v.text));
+      break;
+    }
+    case ORDER_ITEM_SET: {
+      if (len != sizeof(PzOrderItemSetPayload)) return 0;
+      PzOrderItemSetPayload v; memcpy(&v, payload, sizeof(v));
+      w.u8(v.index); w.u8(v.house_id); w.u8(v.mask);
+      w.u16(v.order_id); w.u16(v.remain_s);
+      w.str(v.text, sizeof(v.text));
+      break;
+    }
+    case ORDER_SHOW_TEXT: {
+      if (len != sizeof(PzOrderShowTextPayload)) return 0;
+      PzOrderShowTextPayload v; memcpy(&v, payload, sizeof(v));
+      w.str(v.text, sizeof(v.text));
+      break;
+    }
+    case NET_CFG_SET: {
+      if (len != sizeof(NetCfgSetPayload)) return 0;
+      NetCfgSetPayload v; memcpy(&v, payload, sizeof(v));
+      w.str(v.ssid, sizeof(v.ssid)); w.str(v.pass, sizeof(v.pass)); w.str(v.base, sizeof(v.base));
+      break;
+    }
+    default:
+      return 0;
+  }
+  return w.ok ? (uint16_t)(outMax - w.left) : 0;
+}
+
+bool decode(const uint8_t* p, uint16_t len, PanelTextView& out) {
+  Reader r{ p, len, p != nullptr };
+  out.house_id = r.u8(); out.style = r.u8(); out.speed = r.u8(); out.bright = r.u8();
+  out.text = r.str();
+  return r.done();
+}
+
+bool decode(const uint8_t* p, uint16_t len, PzOrderItemSetView& out) {
+  Reader r{ p, len, p != nullptr };
+  out.index = r.u8(); out.house_id = r.u8(); out.mask = r.u8();
+  out.order_id = r.u16(); out.remain_s = r.u16();
+  out.text = r.str();
+  return r.done();
+}
+
+bool decode(const uint8_t* p, uint16_t len, PzOrderShowTextView& out) {
+  Reader r{ p, len, p != nullptr };
+  out.text = r.str();
+  return r.done();
+}
+
+bool decode(const uint8_t* p, uint16_t len, NetCfgSetView& out) {
+  Reader r{ p, len, p != nullptr };
+  out.ssid = r.str(); out.pass = r.str(); out.base = r.str();
+  return r.done();
+}
+
+uint16_t expandCompact(uint8_t ctype, const uint8_t* p, uint16_t len,
+                       uint8_t* out, uint16_t outMax, uint8_t& outType) {
+  outType = legacyType(ctype);
+  switch (ctype) {
+    case PANEL_TEXT_C: {
+      PanelTextView v; PanelTextPayload f{};
+      if (outMax < sizeof(f) || !decode(p, len, v)) return 0;
+      f.house_id = v.house_id; f.style = v.style; f.speed = v.speed; f.bright = v.bright;
+      toField(v.text, f.text, sizeof(f.text));
+      memcpy(out, &f, sizeof(f));
+      return sizeof(f);
+    }
+    case ORDER_ITEM_SET_C: {
+      PzOrderItemSetView v; PzOrderItemSetPayload f{};
+      if (outMax < sizeof(f) || !decode(p, len, v)) return 0;
+      f.index = v.index; f.house_id = v.house_id; f.mask = v.mask;
+      f.order_id = v.order_id; f.remain_s = v.remain_s;
+      toField(v.text, f.text, sizeof(f.text));
+      memcpy(out, &f, sizeof(f));
+      return sizeof(f);
+    }
+    case ORDER_SHOW_TEXT_C: {
+      PzOrderShowTextView v; PzOrderShowTextPayload f{};
+      if (outMax < sizeof(f) || !decode(p, len, v)) return 0;
+      toField(v.text, f.text, sizeof(f.text));
+      memcpy(out, &f, sizeof(f));
+      return sizeof(f);
+    }
+    case NET_CFG_SET_C: {
+      NetCfgSetView v; NetCfgSetPayload f{};
+      if (outMax < sizeof(f) || !decode(p, len, v)) return 0;
+      toField(v.ssid, f.ssid, sizeof(f.ssid));
+      toField(v.pass, f.pass, sizeof(f.pass));
+      toField(v.base, f.base, sizeof(f.base));
+      memcpy(out, &f, sizeof(f));
+      return sizeof(f);
+    }
+    default:
+      outType = 0;
+      return 0;
+  }
+}
+
+size_t copyStr(const PzStr& s, char* dst, size_t dstSize) {
+  if (!dst || !dstSize) return 0;
+  size_t n = s.len < dstSize - 1 ? s.len : dstSize - 1;
+  if (n) memcpy(dst, s.ptr, n);
+  dst[n] = 0;
+  return n;
+}
+
+} // namespace
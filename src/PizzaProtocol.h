@@ -1,11 +1,22 @@
 #pragma once
-#include <Arduino.h>
+#if defined(ARDUINO)
+  #include <Arduino.h>
+#else
+  // Host builds (benchmarks under extras/) only need the fixed-width types.
+  #include <stdint.h>
+  #include <stddef.h>
+  #include <string.h>
+#endif
 
 // ===== Protocol version =====
 #ifndef PROTOCOL_VERSION
-  #define PROTOCOL_VERSION 2
+  #define PROTOCOL_VERSION 3
 #endif
 
+// First version that understands the compact (length-prefixed) text types.
+// Peers advertise their version in HelloPayload.proto.
+static const uint8_t PZ_PROTO_COMPACT = 3;
+
 
 // Keep text comfortably below ESP-NOW frame limits:
 static const uint8_t PZ_ORDERS_MAX      = 6;
@@ -28,15 +39,38 @@ enum MsgType : uint8_t {
   PIZZA_ING_UPDATE = 210,
   PIZZA_ING_QUERY    = 211,  // Pizza node asks Central for current mask of a UID
   PIZZA_ING_SNAPSHOT = 212,  // Central replies with {uid, mask, ok}
+  CHAN_PROBE        = 220,   // node -> all: is Central on this channel?
+  CHAN_ANNOUNCE     = 221,   // Central -> all: channel it is on / moving to
+  P2P_OFFER         = 222,   // image server -> all: firmware available (PizzaOtaP2P)
+  P2P_JOIN          = 223,   // receiver -> server: taking the offered image
+  P2P_DATA          = 224,   // server -> all: P2pDataHeader + one chunk
+  P2P_POLL          = 225,   // server -> all: report chunks missing below `upto`
+  P2P_NACK          = 226,   // receiver -> server: missing-chunk bitmap
+  P2P_DONE          = 227,   // receiver -> server: image verified (or failed)
   ORDER_LIST_RESET  = 233,
   ORDER_ITEM_SET    = 234,
   ORDER_SHOW_TEXT   = 235,
+  ORDER_ITEM_SET_C  = 236,   // compact ORDER_ITEM_SET  (v3)
+  ORDER_SHOW_TEXT_C = 237,   // compact ORDER_SHOW_TEXT (v3)
+  ORDER_DELTA       = 238,   // versioned order-table changes (PizzaOrders)
+  ORDER_SNAP_REQ    = 239,   // station is out of sync; asks for a full ORDER_DELTA
   HOUSE_DIGITAL_SET = 240,
   ASSET_SYNC        = 241,
   ASSET_RESULT      = 242,
+  PANEL_TEXT_C      = 243,   // compact PANEL_TEXT      (v3)
+  STATS             = 244,   // periodic PizzaNow counters (PizzaNow::enableStatsReport)
+  TIME_BEACON       = 245,   // Central -> all: network clock
+  TIME_REQ          = 246,   // node -> Central: RTT probe
+  TIME_RESP         = 247,   // Central -> node: RTT probe answer
+  TIMED             = 248,   // PzTimedHeader + message to run at a network time
+  NET_CFG_SET_C     = 249,   // compact NET_CFG_SET     (v3)
   NET_CFG_SET       = 250,
   // Broadcast from Central so player stations can hard-disable inputs when the game is idle.
-  GAME_STATE        = 251
+  GAME_STATE        = 251,
+
+  // PizzaNow transport containers; unwrapped before the RxHandler runs.
+  BATCH             = 252,   // payload = several packed messages back to back
+  FRAG              = 253    // payload = FragHeader + one slice of a larger message
 };
 
 // compact caps for order text on panels
@@ -75,6 +109,9 @@ enum DeliverReason : uint8_t {
   DR_WRONG_PIZZA = 3,
 };
 
+// Largest payload PizzaProtocol::pack accepts (keeps ESP-NOW frames < 250 B).
+static const uint16_t PZ_PAYLOAD_MAX = 200;
+
 // ===== Packed header (keep payloads small: <= ~200B total) =====
 struct __attribute__((packed)) MsgHeader {
   uint8_t  type;
@@ -85,6 +122,12 @@ struct __attribute__((packed)) MsgHeader {
   uint16_t crc16;      // header (with crc16=0) + payload
 };
 
+// Sender role lives in the low bits of MsgHeader.role. Bit 7 asks the
+// receiver's PizzaNow to answer with ACK_GENERIC (see PizzaNow::sendReliable);
+// PizzaNow clears it again before the application sees the header.
+static const uint8_t PZ_ROLE_MASK   = 0x7F;
+static const uint8_t PZ_ROLE_ACKREQ = 0x80;
+
 // ===== Payload sketches (keep short, deterministic) =====
 struct HelloPayload {
   char     fw[12];     // "0.1.0"
@@ -183,9 +226,150 @@ struct PzOrderShowTextPayload {
   char text[PZ_ORDER_TEXT_MAX];    // NUL-terminated or NUL-padded
 };
 
+// ORDER_DELTA = PzOrderDeltaHeader + `count` PzOrderDeltaRec. Upserts are
+// followed by text_len bytes of text (no NUL); removes carry no text.
+// A delta applies only on top of base_gen; FULL replaces the whole table.
+static const uint8_t PZ_ORDER_DELTA_FULL = 0x01;
+
+enum OrderDeltaOp : uint8_t {
+  ORDER_OP_UPSERT = 1,
+  ORDER_OP_REMOVE = 2
+};
+
+struct __attribute__((packed)) PzOrderDeltaHeader {
+  uint16_t gen;        // table generation after applying this delta
+  uint16_t base_gen;   // generation it was built on (== gen: heartbeat)
+  uint8_t  count;      // records that follow
+  uint8_t  flags;      // PZ_ORDER_DELTA_*
+};
+
+struct __attribute__((packed)) PzOrderDeltaRec {
+  uint8_t  op;         // OrderDeltaOp
+  uint8_t  index;      // display slot
+  uint8_t  house_id;
+  uint8_t  mask;       // toppings bitmask
+  uint16_t order_id;
+  uint16_t remain_s;   // seconds left at send time, PZ_ORDER_UNTIMED if none
+  uint8_t  text_len;
+};
+static const uint16_t PZ_ORDER_UNTIMED = 0xFFFF;
+
+struct PzOrderSnapReqPayload {
+  uint16_t have_gen;   // receiver's current generation (informational)
+};
+
+struct AckGenericPayload {
+  uint8_t  acked_type;  // MsgType being acknowledged
+  uint8_t  code;        // 0=ok
+  uint16_t acked_seq;   // MsgHeader.seq being acknowledged
+};
+
+// STATS = PzStatsHeader + `count` PzStatsRec (one per tracked MsgType).
+struct PzStatsHeader {
+  uint32_t uptime_s;
+  uint32_t crc_fail;     // frames that failed unpack (CRC/length)
+  uint32_t non_framed;   // frames without the 'P''Z' prefix
+  uint32_t send_fail;    // sends refused or reported failed by the radio
+  uint32_t rx_dropped;   // RX queue overflows
+  uint32_t filtered;     // frames rejected by the RX filter
+  uint8_t  count;
+  uint8_t  rsv[3];
+};
+
+struct PzStatsRec {
+  uint8_t  type;         // MsgType, 0 = everything untracked
+  uint8_t  rsv;
+  uint16_t tx_fail;
+  uint32_t tx;
+  uint32_t rx;
+  uint32_t handler_max_us;
+};
+
+struct ChanProbePayload {
+  uint8_t channel;       // channel being probed
+};
+
+struct ChanAnnouncePayload {
+  uint8_t  channel;      // Central's channel (in_ms == 0) or the one it moves to
+  uint8_t  rsv;
+  uint16_t in_ms;        // move happens this many ms after the announce
+};
+
+// Time sync. All times are esp_timer microseconds; Central's clock is the
+// network clock.
+struct __attribute__((packed)) TimeBeaconPayload {
+  uint64_t central_us;   // Central clock when sent
+};
+
+struct __attribute__((packed)) TimeReqPayload {
+  uint64_t t0;           // requester clock when sent
+};
+
+struct __attribute__((packed)) TimeRespPayload {
+  uint64_t t0;           // echoed from TIME_REQ
+  uint64_t t1;           // Central clock when TIME_REQ arrived
+  uint64_t t2;           // Central clock when this reply was sent
+};
+
+// TIMED = PzTimedHeader + payload of `type`; receivers act on it at at_us.
+struct __attribute__((packed)) PzTimedHeader {
+  uint64_t at_us;        // network time to execute
+  uint8_t  type;         // MsgType of the wrapped payload
+};
+
+// Header of each FRAG slice (PizzaNow fragments payloads > PZ_PAYLOAD_MAX).
+struct FragHeader {
+  uint8_t  type;       // MsgType of the reassembled message
+  uint8_t  index;      // 0..count-1
+  uint8_t  count;      // fragments in this message (<= 32)
+  uint8_t  rsv;        // 0
+  uint16_t msg_id;     // sender-local id shared by all slices (becomes hdr.seq)
+  uint16_t total;      // reassembled payload bytes
+};
+static const uint16_t PZ_FRAG_DATA_MAX = PZ_PAYLOAD_MAX - sizeof(FragHeader);
+
 struct OtaAckPayload { uint8_t accept; uint8_t code; };    // 1/0
 struct OtaResultPayload { uint8_t ok; uint8_t code; };     // 1/0
 
+// ===== Peer-to-peer OTA over ESP-NOW (PizzaOtaP2P) =====
+static const uint16_t PZ_P2P_CHUNK     = 192;   // image bytes per P2P_DATA (16-byte multiple)
+static const uint8_t  PZ_P2P_NACK_BITS = 128;   // chunks covered by one P2P_NACK
+
+struct __attribute__((packed)) P2pOfferPayload {
+  uint16_t session;      // random per serve()
+  uint8_t  target_role;  // Role
+  uint8_t  rsv;
+  char     ver[12];
+  uint32_t size;         // image bytes
+  uint16_t chunks;       // ceil(size / PZ_P2P_CHUNK)
+  uint8_t  sha256[32];   // whole image
+};
+
+struct __attribute__((packed)) P2pJoinPayload { uint16_t session; };
+
+struct __attribute__((packed)) P2pDataHeader {
+  uint16_t session;
+  uint16_t idx;          // chunk index; data follows, PZ_P2P_CHUNK bytes (last: remainder)
+};
+static_assert(sizeof(P2pDataHeader) + PZ_P2P_CHUNK <= PZ_PAYLOAD_MAX, "P2P_DATA must fit one frame");
+
+struct __attribute__((packed)) P2pPollPayload {
+  uint16_t session;
+  uint16_t upto;         // chunks [0, upto) have been sent at least once
+};
+
+struct __attribute__((packed)) P2pNackPayload {
+  uint16_t session;
+  uint16_t base;         // lowest missing chunk
+  uint8_t  bits[PZ_P2P_NACK_BITS / 8];   // bit i set: chunk base+i missing
+};
+
+struct __attribute__((packed)) P2pDonePayload {
+  uint16_t session;
+  uint8_t  ok;
+  uint8_t  code;         // PizzaOta::Result when !ok
+};
+
 // One-shot "describe everything" for a House
 struct HouseDigitalSetPayload {
   uint8_t  house_id;       // target
@@ -231,11 +415,61 @@ struct NetCfgSetPayload {
   char base[96];   // NUL-terminated (asset/OTA base URL)  <-- was 128
 };
 
+// ===== Compact (v3) text messages =====
+// Same fields as the fixed structs, but each string is sent as <len u8><bytes>
+// with no NUL padding, and u16 fields are little-endian:
+//   PANEL_TEXT_C      house_id style speed bright str(text)
+//   ORDER_ITEM_SET_C  index house_id mask order_id remain_s str(text)
+//   ORDER_SHOW_TEXT_C str(text)
+//   NET_CFG_SET_C     str(ssid) str(pass) str(base)
+// Decoding yields views that point into the received frame.
+
+// String view into a received frame. NOT NUL-terminated.
+struct PzStr {
+  const char* ptr;
+  uint8_t     len;
+};
+
+struct PanelTextView {
+  uint8_t house_id;
+  uint8_t style, speed, bright;
+  PzStr   text;
+};
+
+struct PzOrderItemSetView {
+  uint8_t  index, house_id, mask;
+  uint16_t order_id;
+  uint16_t remain_s;
+  PzStr    text;
+};
+
+struct PzOrderShowTextView {
+  PzStr text;
+};
+
+struct NetCfgSetView {
+  PzStr ssid, pass, base;
+};
+
 // ===== Helpers =====
 namespace PizzaProtocol {
-  // CRC16-CCITT (0x1021, init=0xFFFF)
+  // CRC16-CCITT (0x1021, init=0xFFFF). Engine selected by PZ_CRC_ENGINE.
   uint16_t crc16(const uint8_t* data, size_t len);
 
+  // Incremental form: crc16(a+b) == crc16Update(crc16Update(CRC16_INIT, a), b).
+  // Lets callers hash scattered pieces in place instead of staging a copy.
+  static const uint16_t CRC16_INIT = 0xFFFF;
+  uint16_t crc16Update(uint16_t crc, const void* data, size_t len);
+
+  // Individual engines (all give the same result as crc16). Exposed so the
+  // host benchmark can compare them; unused ones are dropped by --gc-sections.
+  uint16_t crc16Bitwise(const uint8_t* data, size_t len);
+  uint16_t crc16Table(const uint8_t* data, size_t len);
+  uint16_t crc16Slice4(const uint8_t* data, size_t len);
+  uint16_t crc16Slice8(const uint8_t* data, size_t len);
+  uint16_t crc16Rom(const uint8_t* data, size_t len);   // == crc16Table if no ROM
+  bool     crc16HasRom();
+
   // Pack header+payload into outBuf; returns total bytes, 0 on error
   size_t pack(uint8_t type, Role role, uint8_t house_id,
               uint16_t seq, const void* payload, uint16_t payload_len,
@@ -244,4 +478,29 @@ namespace PizzaProtocol {
   // Unpack header; returns true if CRC ok and lengths valid
   bool unpack(const uint8_t* inBuf, uint16_t inLen,
               MsgHeader& outHdr, const uint8_t*& outPayload, uint16_t& outPayLen);
+
+  // ----- Compact encoding -----
+  // Compact twin of a fixed-layout type (PANEL_TEXT -> PANEL_TEXT_C, ...), or
+  // 0 if the type has none. legacyType() is the inverse.
+  uint8_t compactType(uint8_t type);
+  uint8_t legacyType(uint8_t compactType);
+
+  // Encodes a fixed struct (payload/len as for pack) into compact form.
+  // Returns bytes written, 0 if the type has no compact form or out is short.
+  uint16_t encodeCompact(uint8_t type, const void* payload, uint16_t len,
+                         uint8_t* out, uint16_t outMax);
+
+  // Rebuilds the fixed struct from a compact payload (strings NUL-padded).
+  // Returns the struct size and sets outType to the legacy type, 0 on error.
+  uint16_t expandCompact(uint8_t compactType, const uint8_t* p, uint16_t len,
+                         uint8_t* out, uint16_t outMax, uint8_t& outType);
+
+  // Zero-copy views over a compact payload; false if malformed.
+  bool decode(const uint8_t* p, uint16_t len, PanelTextView& out);
+  bool decode(const uint8_t* p, uint16_t len, PzOrderItemSetView& out);
+  bool decode(const uint8_t* p, uint16_t len, PzOrderShowTextView& out);
+  bool decode(const uint8_t* p, uint16_t len, NetCfgSetView& out);
+
+  // Copies a view into a C string (always NUL-terminated); returns length.
+  size_t copyStr(const PzStr& s, char* dst, size_t dstSize);
 }
@@ -0,0 +1,151 @@
+#include "PizzaSimRadio.h"
+#include <string.h>
+
+namespace PizzaSimRadio {
+
+static const uint8_t kBroadcast[6] = {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
+
+Medium::Medium(const Config& cfg)
+  : _cfg(cfg), _stats(), _rng(cfg.seed ? cfg.seed : 1), _nodes(), _count(0) {
+  _air.reserve(cfg.maxInFlight);
+}
+
+int Medium::attach(const uint8_t mac[6], RxFn fn, void* ctx, uint8_t channel) {
+  if (_count >= MAX_NODES) return -1;
+  Node& n = _nodes[_count];
+  memcpy(n.mac, mac, 6);
+  n.channel = channel;
+  n.fn  = fn;
+  n.ctx = ctx;
+  return _count++;
+}
+
+void Medium::setChannel(int node, uint8_t channel) {
+  if (node >= 0 && node < _count) _nodes[node].channel = channel;
+}
+
+void Medium::setRx(int node, RxFn fn, void* ctx) {
+  if (node < 0 || node >= _count) return;
+  _nodes[node].fn  = fn;
+  _nodes[node].ctx = ctx;
+}
+
+// xorshift32: cheap and reproducible across platforms.
+uint32_t Medium::rand32() {
+  _rng ^= _rng << 13;
+  _rng ^= _rng >> 17;
+  _rng ^= _rng << 5;
+  return _rng;
+}
+
+bool Medium::chance(uint8_t pct) {
+  return pct && (rand32() % 100u) < pct;
+}
+
+void Medium::enqueue(int from, int to, const uint8_t* data, size_t len, uint64_t nowUs) {
+  if (_air.size() >= _cfg.maxInFlight) { _stats.overflow++; return; }
+  Pending p;
+  p.dueUs = nowUs + _cfg.latencyUs + (_cfg.jitterUs ? rand32() % (_cfg.jitterUs + 1) : 0);
+  p.from  = (int16_t)from;
+  p.to    = (int16_t)to;
+  p.len   = (uint16_t)len;
+  memcpy(p.data, data, len);
+  _air.push_back(p);
+}
+
+bool Medium::send(int node, const uint8_t dst[6], const uint8_t* data, size_t len, uint64_t nowUs) {
+  if (node < 0 || node >= _count || !data || len == 0 || len > sizeof(Pending::data)) return false;
+  _stats.sent++;
+
+  const bool bcast = memcmp(dst, kBroadcast, 6) == 0;
+  const uint8_t ch = _nodes[node].channel;
+  bool any = false;
+  for (int i = 0; i < _count; i++) {
+    if (i == node || _nodes[i].channel != ch) continue;
+    if (!bcast && memcmp(_nodes[i].mac, dst, 6) != 0) continue;
+    if (chance(_cfg.lossPct)) { _stats.lost++; continue; }
+    enqueue(node, i, data, len, nowUs);
+    if (chance(_cfg.dupPct)) { enqueue(node, i, data, len, nowUs); _stats.duplicated++; }
+    any = true;
+  }
+  return any;
+}
+
+uint64_t Medium::nextDueUs() const {
+  uint64_t due = UINT64_MAX;
+  for (const Pending& p : _air) if (p.dueUs < due) due = p.dueUs;
+  return due;
+}
+
+void Medium::poll(uint64_t nowUs) {
+  for (;;) {
+    size_t best = _air.size();
+    for (size_t i = 0; i < _air.size(); i++) {
+      if (_air[i].dueUs > nowUs) continue;
+      if (best == _air.size() || _air[i].dueUs < _air[best].dueUs) best = i;
+    }
+    if (best == _air.size()) return;
+
+    // Move out first: the receiver may send (and grow _air) re-entrantly.
+    Pending p = _air[best];
+    _air[best] = _air.back();
+    _air.pop_back();
+
+    const Node& from = _nodes[p.from];
+    const Node& to   = _nodes[p.to];
+    if (to.fn && to.channel == from.channel) {
+      _stats.delivered++;
+      to.fn(to.ctx, from.mac, p.data, p.len);
+    }
+  }
+}
+
+// ===== Link =====
+
+Link::Link(Medium& medium, const uint8_t mac[6], ClockFn clock)
+  : _medium(medium), _clock(clock), _node(-1), _up(false), _rx(nullptr), _sent(nullptr) {
+  _node = _medium.attach(mac, nullptr, nullptr);
+}
+
+bool Link::begin(uint8_t channel, RxCB rx, SentCB sent) {
+  if (_node < 0) return false;
+  _rx = rx;
+  _sent = sent;
+  _medium.setChannel(_node, channel);
+  _medium.setRx(_node, onAir, this);
+  _up = true;
+  return true;
+}
+
+void Link::end() {
+  _medium.setRx(_node, nullptr, nullptr);
+  _up = false;
+}
+
+bool Link::send(const uint8_t mac[6], const uint8_t* data, size_t len) {
+  if (!_up) return false;
+  bool arrived = _medium.send(_node, mac, data, len, _clock());
+  if (_sent && memcmp(mac, kBroadcast, 6) != 0) _sent(mac, arrived);
+  return true;   // like esp_now_send: queued; delivery is reported via SentCB
+}
+
+// The simulated air needs no peer table: every node can reach every other.
+bool Link::addPeer(const uint8_t*, uint8_t) { return true; }
+bool Link::removePeer(const uint8_t*) { return true; }
+bool Link::hasPeer(const uint8_t*) { return true; }
+
+bool Link::setChannel(uint8_t channel) {
+  _medium.setChannel(_node, channel);
+  return true;
+}
+
+void Link::poll() {
+  if (_up) _medium.poll(_clock());
+}
+
+void Link::onAir(void* ctx, const uint8_t src[6], const uint8_t* data, int len) {
+  Link* self = (Link*)ctx;
+  if (self->_rx) self->_rx(src, data, len);
+}
+
+} // namespace PizzaSimRadio
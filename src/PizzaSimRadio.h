@@ -0,0 +1,120 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "PizzaTransport.h"
+
+// ===== Simulated ESP-NOW medium =====
+// An in-process "air" shared by many virtual nodes, with configurable loss,
+// duplication, latency and jitter. Deterministic for a given seed, and free
+// of Arduino dependencies so it also runs on a Linux host.
+//
+// Each node attaches with a MAC and a receive function. Scripted nodes (e.g.
+// six HouseNodes answering a Central) can use the medium directly; the local
+// device's PizzaNow joins through a Link:
+//
+//   PizzaSimRadio::Medium air(cfg);
+//   PizzaSimRadio::Link   me(air, myMac, clockUs);
+//   PizzaNow::setTransport(&me);   // before PizzaNow::begin()
+//
+// On a host, pass PizzaHost::nowUs as the clock so the Link and PizzaNow
+// share the virtual time the program advances (extras/bench/pz_bench.cpp).
+namespace PizzaSimRadio {
+
+  struct Config {
+    uint8_t  lossPct   = 0;      // 0..100, per delivery
+    uint8_t  dupPct    = 0;      // 0..100, chance a delivery happens twice
+    uint32_t latencyUs = 1000;   // base one-way latency
+    uint32_t jitterUs  = 0;      // + uniform 0..jitterUs
+    uint32_t seed      = 1;
+    uint16_t maxInFlight = 256;  // frames queued in the air; excess is dropped
+  };
+
+  struct Stats {
+    uint32_t sent;               // send() calls
+    uint32_t delivered;          // frames handed to a receiver
+    uint32_t lost;               // dropped by lossPct
+    uint32_t duplicated;         // extra copies injected by dupPct
+    uint32_t overflow;           // dropped because maxInFlight was reached
+  };
+
+  typedef void (*RxFn)(void* ctx, const uint8_t src[6], const uint8_t* data, int len);
+
+  class Medium {
+   public:
+    static const int MAX_NODES = 24;
+
+    explicit Medium(const Config& cfg);
+
+    // Returns the node id, or -1 when full.
+    int  attach(const uint8_t mac[6], RxFn fn, void* ctx, uint8_t channel = 1);
+    void setChannel(int node, uint8_t channel);
+    void setRx(int node, RxFn fn, void* ctx);
+
+    // Queues a frame from `node`; FF:FF:FF:FF:FF:FF reaches every other node
+    // on the same channel. Returns true if at least one copy will arrive
+    // (for unicast this is what ESP-NOW's send status would report).
+    bool send(int node, const uint8_t dst[6], const uint8_t* data, size_t len, uint64_t nowUs);
+
+    // Delivers every frame due at or before nowUs, in due-time order.
+    void poll(uint64_t nowUs);
+    // Due time of the next queued frame, or UINT64_MAX when the air is empty.
+    uint64_t nextDueUs() const;
+
+    const Stats& stats() const { return _stats; }
+
+   private:
+    struct Node {
+      uint8_t mac[6];
+      uint8_t channel;
+      RxFn    fn;
+      void*   ctx;
+    };
+    struct Pending {
+      uint64_t dueUs;
+      int16_t  from;
+      int16_t  to;
+      uint16_t len;
+      uint8_t  data[250];
+    };
+
+    uint32_t rand32();
+    bool     chance(uint8_t pct);
+    void     enqueue(int from, int to, const uint8_t* data, size_t len, uint64_t nowUs);
+
+    Config               _cfg;
+    Stats                _stats;
+    uint32_t             _rng;
+    Node                 _nodes[MAX_NODES];
+    int                  _count;
+    std::vector<Pending> _air;
+  };
+
+  // PizzaTransport backed by a Medium node. The clock supplies microseconds
+  // (esp_timer_get_time on device, steady_clock on a host).
+  class Link : public PizzaTransport {
+   public:
+    typedef uint64_t (*ClockFn)();
+
+    Link(Medium& medium, const uint8_t mac[6], ClockFn clock);
+
+    bool begin(uint8_t channel, RxCB rx, SentCB sent) override;
+    void end() override;
+    bool send(const uint8_t mac[6], const uint8_t* data, size_t len) override;
+    bool addPeer(const uint8_t mac[6], uint8_t channel) override;
+    bool removePeer(const uint8_t mac[6]) override;
+    bool hasPeer(const uint8_t mac[6]) override;
+    bool setChannel(uint8_t channel) override;
+    void poll() override;
+
+   private:
+    static void onAir(void* ctx, const uint8_t src[6], const uint8_t* data, int len);
+
+    Medium& _medium;
+    ClockFn _clock;
+    int     _node;
+    bool    _up;
+    RxCB    _rx;
+    SentCB  _sent;
+  };
+}
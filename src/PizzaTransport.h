@@ -0,0 +1,34 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// ===== Radio transport used by PizzaNow =====
+// PizzaNow never calls esp_now_* directly; it goes through one of these.
+// The default backend is ESP-NOW (inside PizzaNow.cpp). PizzaSimRadio::Link
+// is an in-process simulated radio for loopback runs and host benchmarks.
+// Kept Arduino-free so host builds can implement it; on a host PizzaNow
+// itself builds against PizzaHost.h (virtual clock, no-op locks, RAM NVS)
+// and has no default backend, so setTransport() a Link before begin().
+struct PizzaTransport {
+  // Backends report received frames (still wire-prefixed) and, for unicast,
+  // whether the peer's radio acknowledged the frame.
+  typedef void (*RxCB)(const uint8_t mac[6], const uint8_t* data, int len);
+  typedef void (*SentCB)(const uint8_t mac[6], bool ok);
+
+  virtual ~PizzaTransport() {}
+
+  virtual bool begin(uint8_t channel, RxCB rx, SentCB sent) = 0;
+  virtual void end() = 0;
+  virtual bool send(const uint8_t mac[6], const uint8_t* data, size_t len) = 0;
+  virtual bool addPeer(const uint8_t mac[6], uint8_t channel) = 0;
+  virtual bool removePeer(const uint8_t mac[6]) = 0;
+  virtual bool hasPeer(const uint8_t mac[6]) = 0;
+
+  // Retunes the radio while up (peers follow). false if the backend cannot.
+  virtual bool setChannel(uint8_t channel) { (void)channel; return false; }
+  // Channel the radio is actually on (e.g. an associated AP's), 0 if unknown.
+  virtual uint8_t radioChannel() { return 0; }
+
+  // Called from PizzaNow::loop(); simulated backends deliver due frames here.
+  virtual void poll() {}
+};
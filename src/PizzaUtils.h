@@ -1,5 +1,10 @@
 #pragma once
-#include <Arduino.h>
+#if defined(ARDUINO)
+  #include <Arduino.h>
+  #include <esp_timer.h>
+#else
+  #include "PizzaHost.h"
+#endif
 
 #define PZ_LOGI(...)  do { Serial.printf("[INFO] " __VA_ARGS__); Serial.println(); } while(0)
 #define PZ_LOGE(...)  do { Serial.printf("[ERR ] " __VA_ARGS__); Serial.println(); } while(0)
@@ -17,4 +22,102 @@ namespace PizzaUtils {
     void reset(uint32_t ms){ everyMs=ms; nextAt=millis()+ms; }
     bool ready(){ if ((int32_t)(millis()-nextAt) >= 0){ nextAt += everyMs; return true; } return false; }
   };
+
+  // Deferred callbacks keyed on esp_timer time (us). Fixed pool of N entries,
+  // each carrying up to DataMax bytes copied at schedule time; a binary
+  // min-heap of pool indices keeps add/pop at O(log N) and the next due time
+  // at O(1), so run() costs one compare when nothing is due.
+  template <uint8_t N, uint16_t DataMax>
+  class Scheduler {
+  public:
+    typedef void (*Fn)(void* ctx, const uint8_t* data, uint16_t len);
+
+    Scheduler() { clear(); }
+
+    void clear() {
+      n_ = 0;
+      f_ = N;
+      for (uint8_t i = 0; i < N; i++) free_[i] = i;
+    }
+
+    // false if the pool is full or len > DataMax.
+    bool at(int64_t dueUs, Fn fn, void* ctx = nullptr, const void* data = nullptr, uint16_t len = 0) {
+      if (!f_ || len > DataMax || !fn) return false;
+      const uint8_t slot = free_[--f_];
+      Entry& e = pool_[slot];
+      e.dueUs = dueUs; e.fn = fn; e.ctx = ctx; e.len = len;
+      if (len) memcpy(e.data, data, len);
+      heap_[n_] = slot;
+      up(n_++);
+      return true;
+    }
+    bool after(uint32_t delayUs, Fn fn, void* ctx = nullptr, const void* data = nullptr, uint16_t len = 0) {
+      return at(esp_timer_get_time() + delayUs, fn, ctx, data, len);
+    }
+
+    // Runs everything due by nowUs, earliest first; returns how many ran.
+    // Callbacks may schedule more work.
+    uint8_t run(int64_t nowUs = esp_timer_get_time()) {
+      uint8_t ran = 0;
+      while (n_ && pool_[heap_[0]].dueUs <= nowUs) {
+        const uint8_t slot = heap_[0];
+        heap_[0] = heap_[--n_];
+        if (n_) down(0);
+        Entry& e = pool_[slot];
+        e.fn(e.ctx, e.data, e.len);         // slot stays reserved while it runs
+        free_[f_++] = slot;
+        ran++;
+      }
+      return ran;
+    }
+
+    // Takes the earliest entry out if it is due by nowUs and copies its data
+    // (DataMax bytes room) so the caller can run it after dropping a lock.
+    bool popDue(int64_t nowUs, Fn& fn, void*& ctx, uint8_t* data, uint16_t& len) {
+      if (!n_ || pool_[heap_[0]].dueUs > nowUs) return false;
+      const uint8_t slot = heap_[0];
+      heap_[0] = heap_[--n_];
+      if (n_) down(0);
+      const Entry& e = pool_[slot];
+      fn = e.fn; ctx = e.ctx; len = e.len;
+      if (len) memcpy(data, e.data, len);
+      free_[f_++] = slot;
+      return true;
+    }
+
+    int64_t nextDueUs() const { return n_ ? pool_[heap_[0]].dueUs : INT64_MAX; }
+    uint8_t size() const      { return n_; }
+    uint8_t capacity() const  { return N; }
+
+  private:
+    struct Entry {
+      int64_t  dueUs;
+      Fn       fn;
+      void*    ctx;
+      uint16_t len;
+      uint8_t  data[DataMax];
+    };
+
+    bool less(uint8_t a, uint8_t b) const { return pool_[heap_[a]].dueUs < pool_[heap_[b]].dueUs; }
+    void swap(uint8_t a, uint8_t b) { uint8_t t = heap_[a]; heap_[a] = heap_[b]; heap_[b] = t; }
+    void up(uint8_t i) {
+      while (i && less(i, (uint8_t)((i - 1) / 2))) { swap(i, (uint8_t)((i - 1) / 2)); i = (uint8_t)((i - 1) / 2); }
+    }
+    void down(uint8_t i) {
+      for (;;) {
+        uint8_t m = i;
+        const uint16_t l = 2u * i + 1, r = l + 1;
+        if (l < n_ && less((uint8_t)l, m)) m = (uint8_t)l;
+        if (r < n_ && less((uint8_t)r, m)) m = (uint8_t)r;
+        if (m == i) return;
+        swap(i, m); i = m;
+      }
+    }
+
+    Entry   pool_[N];
+    uint8_t heap_[N];     // pool indices, min-heap on dueUs
+    uint8_t free_[N];     // stack of unused pool indices, f_ entries
+    uint8_t n_;
+    uint8_t f_;
+  };
 }
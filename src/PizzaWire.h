@@ -0,0 +1,57 @@
+#pragma once
+#include "PizzaProtocol.h"
+#include "BuildConfig.h"
+
+// ===== Wire framing =====
+// 'P' 'Z' <wire_version> in front of every packed message (see BuildConfig.h).
+// Kept header-only and Arduino-free so the host benchmarks can exercise the
+// exact same framing code as the radio path.
+namespace PizzaWire {
+  static const uint16_t MAX_FRAME  = 250;   // ESP_NOW_MAX_DATA_LEN
+  static const uint8_t  PREFIX_LEN = 3;
+
+#if PZ_WIRE_TX_FRAMED
+  static const uint8_t  TX_PREFIX_LEN = PREFIX_LEN;
+#else
+  static const uint8_t  TX_PREFIX_LEN = 0;
+#endif
+
+  // Largest packed message (header+payload) that fits behind our TX prefix.
+  static const uint16_t MAX_MSG = MAX_FRAME - TX_PREFIX_LEN;
+
+  // Writes the TX prefix (if framing is enabled); returns bytes written.
+  inline uint8_t writePrefix(uint8_t* out) {
+#if PZ_WIRE_TX_FRAMED
+    out[0] = (uint8_t)PZ_WIRE_MAGIC0;
+    out[1] = (uint8_t)PZ_WIRE_MAGIC1;
+    out[2] = (uint8_t)PZ_WIRE_VERSION;
+#else
+    (void)out;
+#endif
+    return TX_PREFIX_LEN;
+  }
+
+  // Strips the prefix from a received frame; false if it is not one of ours.
+  inline bool strip(const uint8_t* in, int inLen, const uint8_t*& out, int& outLen) {
+    if (!in || inLen <= 0) return false;
+
+    // New framed packets
+    if (inLen >= PREFIX_LEN &&
+        in[0] == (uint8_t)PZ_WIRE_MAGIC0 &&
+        in[1] == (uint8_t)PZ_WIRE_MAGIC1 &&
+        in[2] == (uint8_t)PZ_WIRE_VERSION) {
+      out = in + PREFIX_LEN;
+      outLen = inLen - PREFIX_LEN;
+      return true;
+    }
+
+#if PZ_WIRE_RX_LEGACY
+    // Legacy packets (no wire prefix)
+    out = in;
+    outLen = inLen;
+    return true;
+#else
+    return false;
+#endif
+  }
+}